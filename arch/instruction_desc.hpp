@@ -27,10 +27,12 @@
 //
 #pragma once
 #include <string>
-#include <vector>
+#include <string_view>
+#include <initializer_list>
 #include <vtil/io>
 #include <vtil/math>
 #include "operands.hpp"
+#include "..\misc\fixed_vector.hpp"
 
 namespace vtil
 {
@@ -38,6 +40,15 @@ namespace vtil
     //
     static constexpr size_t max_operand_count = 4;
 
+    // Type we use to describe the numeric opcode of an instruction in.
+    //
+    using opcode_t = uint16_t;
+    static constexpr opcode_t invalid_opcode = -1;
+
+    // Maximum number of opcodes that can be registered at once.
+    //
+    static constexpr size_t max_opcode_count = 1024;
+
     // Describes the way an instruction acceses it's operands and the
     // constraints built around that, such as "immediate only" implied 
     // by the "_imm" suffix.
@@ -68,16 +79,24 @@ namespace vtil
     // in the VTIL instruction set. This type should be only constructed 
     // as a global constant. For the sake of consistency all operand indices
     // passed to the constructor start from 1. [Ref: branch_operands desc.]
+    // - All properties are stored inline so that the descriptors can be
+    //   declared constexpr and queried at compile-time.
     //
     struct instruction_desc
     {
+        // Stable numeric identifier of the instruction, used as the
+        // index into the instruction registry.
+        //
+        opcode_t opcode = invalid_opcode;
+
         // Name of the instruction.
+        // - Must be backed by a string that outlives the descriptor.
         //
-        std::string name;
+        std::string_view name;
 
         // List of the access types for each operand.
         //
-        std::vector<operand_access> access_types;
+        fixed_vector<operand_access, max_operand_count> access_types;
 
         // Index of the operand that determines the instruction's 
         // access size property.
@@ -99,8 +118,8 @@ namespace vtil
         //   indicate "real" destinations and thus for the sake of 
         //   simplicity indices start from 1.
         //
-        std::vector<int> branch_operands_rip = {};
-        std::vector<int> branch_operands_vip = {};
+        fixed_vector<int, max_operand_count> branch_operands_rip = {};
+        fixed_vector<int, max_operand_count> branch_operands_vip = {};
 
         // Operand that marks the beginning of a memory reference and whether
         // it writes to the pointer or not. [Idx] must be a register and [Idx+1]
@@ -111,36 +130,60 @@ namespace vtil
 
         // Generic data-assignment constructor with certain validity checks.
         //
-        instruction_desc( const std::string& name,
-                          const std::vector<operand_access>& access_types,
-                          int access_size_index,
-                          bool is_volatile,
-                          math::operator_id symbolic_operator,
-                          std::vector<int> branch_operands,
-                          const std::pair<int, bool>& memory_operands );
+        constexpr instruction_desc( opcode_t opcode,
+                                    std::string_view name,
+                                    std::initializer_list<operand_access> access_types,
+                                    int access_size_index,
+                                    bool is_volatile,
+                                    math::operator_id symbolic_operator,
+                                    std::initializer_list<int> branch_operands,
+                                    const std::pair<int, bool>& memory_operands ) :
+            opcode( opcode ), name( name ), access_types( access_types ), access_size_index( access_size_index - 1 ),
+            is_volatile( is_volatile ), symbolic_operator( symbolic_operator ),
+            memory_operand_index( memory_operands.first - 1 ), memory_write( memory_operands.second )
+        {
+            auto abs = [ ] ( int x ) { return x < 0 ? -x : x; };
+
+            // Validate all operand indices.
+            //
+            validate( access_size_index == 0 || abs( access_size_index ) <= operand_count() );
+            validate( memory_operands.first == 0 || abs( memory_operands.first ) <= operand_count() );
+            for ( int op : branch_operands )
+                validate( op != 0 && abs( op ) <= operand_count() );
+
+            // Process branch operands.
+            //
+            for ( int op : branch_operands )
+            {
+                if ( op > 0 )
+                    branch_operands_vip.push_back( op - 1 );
+                else
+                    branch_operands_rip.push_back( -op - 1 );
+            }
+        }
 
         // Number of operands this instruction has.
         //
-        size_t operand_count() const { return access_types.size(); }
+        constexpr size_t operand_count() const { return access_types.size(); }
 
         // Whether the instruction branches for not.
         //
-        bool is_branching_virt() const { return !branch_operands_vip.empty(); }
-        bool is_branching_real() const { return !branch_operands_rip.empty(); }
-        bool is_branching() const { return is_branching_virt() || is_branching_real(); }
+        constexpr bool is_branching_virt() const { return !branch_operands_vip.empty(); }
+        constexpr bool is_branching_real() const { return !branch_operands_rip.empty(); }
+        constexpr bool is_branching() const { return is_branching_virt() || is_branching_real(); }
 
         // Whether the instruction acceses/reads/writes memory or not.
         //
-        bool reads_memory() const { return accesses_memory() && !memory_write; }
-        bool writes_memory() const { return accesses_memory() && memory_write; }
-        bool accesses_memory() const { return memory_operand_index != -1; }
+        constexpr bool reads_memory() const { return accesses_memory() && !memory_write; }
+        constexpr bool writes_memory() const { return accesses_memory() && memory_write; }
+        constexpr bool accesses_memory() const { return memory_operand_index != -1; }
 
         // Conversion to human-readable format.
         //
 	    std::string to_string( size_t access_size ) const
 	    {
-		    if ( !access_size ) return name;
-		    return name + ( char ) format::suffix_map[ access_size ];
+		    if ( !access_size ) return std::string{ name };
+		    return std::string{ name } + ( char ) format::suffix_map[ access_size ];
 	    }
 
         // Redirect basic comparison operators to the name of the instruction.
@@ -148,8 +191,15 @@ namespace vtil
         bool operator!=( const std::string& o ) const { return name != o; }
         bool operator==( const std::string& o ) const { return name == o; }
         bool operator<( const std::string& o ) const { return name < o; }
-        bool operator!=( const instruction_desc& o ) const { return name != o.name; }
-        bool operator==( const instruction_desc& o ) const { return name == o.name; }
-        bool operator<( const instruction_desc& o ) const { return name < o.name; }
+        constexpr bool operator!=( const instruction_desc& o ) const { return name != o.name; }
+        constexpr bool operator==( const instruction_desc& o ) const { return name == o.name; }
+        constexpr bool operator<( const instruction_desc& o ) const { return name < o.name; }
+
+    private:
+        // Validates the descriptor properties, failing the constant evaluation
+        // at compile-time and raising an assertion at runtime.
+        //
+        static constexpr void validate( bool condition ) { if ( !condition ) invalid(); }
+        static void invalid() { fassert( !"Invalid instruction descriptor." ); }
     };
 };
\ No newline at end of file
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "instruction_set.hpp"
+#include <mutex>
+#include <atomic>
+
+namespace vtil
+{
+	// Table of user-defined instructions, indexed by their opcodes. Lookups are
+	// lock-free while insertions are serialized by the mutex.
+	//
+	static std::mutex user_instruction_mutex;
+	static std::atomic<const instruction_desc*> user_instruction_table[ max_opcode_count ] = {};
+
+	// Looks up the instruction descriptor registered for the given opcode 
+	// in constant time, returns nullptr if the opcode is not registered.
+	//
+	const instruction_desc* lookup_instruction( opcode_t opcode )
+	{
+		// Built-in instructions are stored at their opcodes.
+		//
+		if ( opcode < first_user_opcode )
+			return instruction_list[ opcode ];
+
+		// Otherwise, check the user table.
+		//
+		if ( opcode >= max_opcode_count )
+			return nullptr;
+		return user_instruction_table[ opcode ].load( std::memory_order_acquire );
+	}
+
+	// Registers a user-defined instruction descriptor under the opcode requested,
+	// or the first free opcode if none is specified, and writes it into the descriptor.
+	// Returns the assigned opcode or invalid_opcode if it collides with an existing one.
+	//
+	opcode_t register_instruction( instruction_desc& desc, opcode_t opcode )
+	{
+		std::lock_guard _g( user_instruction_mutex );
+
+		// If no opcode was requested, pick the first free slot.
+		//
+		if ( opcode == invalid_opcode )
+		{
+			for ( size_t i = first_user_opcode; i < max_opcode_count; i++ )
+			{
+				if ( !user_instruction_table[ i ].load( std::memory_order_relaxed ) )
+				{
+					opcode = ( opcode_t ) i;
+					break;
+				}
+			}
+			
+			// Fail if the table is full.
+			//
+			if ( opcode == invalid_opcode )
+				return invalid_opcode;
+		}
+
+		// Fail if the opcode is reserved, out of bounds or already taken.
+		//
+		if ( opcode < first_user_opcode || opcode >= max_opcode_count ||
+			 user_instruction_table[ opcode ].load( std::memory_order_relaxed ) )
+			return invalid_opcode;
+
+		// Assign the opcode and publish the descriptor.
+		//
+		desc.opcode = opcode;
+		user_instruction_table[ opcode ].store( &desc, std::memory_order_release );
+		return opcode;
+	}
+};
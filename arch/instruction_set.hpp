@@ -26,7 +26,7 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
-#include <vector>
+#include <iterator>
 #include <vtil/math>
 #include "instruction_desc.hpp"
 
@@ -44,13 +44,13 @@ namespace vtil
         //    STR        Reg,    Imm,    Reg/Imm                             | [OP1+OP2] <= OP3
         //    LDD        Reg,    Reg,    Imm                                 | OP1 <= [OP2+OP3]
         //
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
-        /*                                          [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
-        static const instruction_desc mov =        { "mov",        { a::write,    a::read_any                   },    2,          false,      {},         {},         {}           };
-        static const instruction_desc movr =       { "movr",       { a::write,    a::read_imm                   },    2,          false,      {},         {},         {}           };
-        static const instruction_desc str =        { "str",        { a::read_reg, a::read_imm,     a::read_any  },    3,          false,      {},         {},         { 1, true }  };
-        static const instruction_desc ldd =        { "ldd",        { a::write,    a::read_reg,     a::read_imm  },    1,          false,      {},         {},         { 2, false } };
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*                                              [Id]  [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
+        inline constexpr instruction_desc mov =        { 0,    "mov",        { a::write,    a::read_any                   },    2,          false,      {},         {},         {}           };
+        inline constexpr instruction_desc movr =       { 1,    "movr",       { a::write,    a::read_imm                   },    2,          false,      {},         {},         {}           };
+        inline constexpr instruction_desc str =        { 2,    "str",        { a::read_reg, a::read_imm,     a::read_any  },    3,          false,      {},         {},         { 1, true }  };
+        inline constexpr instruction_desc ldd =        { 3,    "ldd",        { a::write,    a::read_reg,     a::read_imm  },    1,          false,      {},         {},         { 2, false } };
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
 
         //    -- Arithmetic instructions
         //
@@ -66,20 +66,20 @@ namespace vtil
         //    IDIV       Reg,    Reg/Imm    Reg/Imm                          | OP1 = [OP2:OP1] / OP3   (Signed)
         //    IREM       Reg,    Reg/Imm                                     | OP1 = OP1 % OP2         (Signed)
         //
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
-        /*                                          [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
-        static const instruction_desc neg =        { "neg",       { a::readwrite                                 },    1,            false,    op::negate,              {},         {}           };
-        static const instruction_desc add =        { "add",       { a::readwrite,  a::read_any                   },    1,            false,    op::add,                 {},         {}           };
-        static const instruction_desc sub =        { "sub",       { a::readwrite,  a::read_any                   },    1,            false,    op::substract,           {},         {}           };
-        static const instruction_desc mul =        { "mul",       { a::readwrite,  a::read_any                   },    1,            false,    op::umultiply,           {},         {}           };
-        static const instruction_desc imul =       { "imul",      { a::readwrite,  a::read_any                   },    1,            false,    op::multiply,            {},         {}           };
-        static const instruction_desc mulhi =      { "mulhi",     { a::readwrite,  a::read_any                   },    1,            false,    op::multiply_high,       {},         {}           };
-        static const instruction_desc imulhi =     { "imulhi",    { a::readwrite,  a::read_any                   },    1,            false,    op::umultiply_high,      {},         {}           };
-        static const instruction_desc div =        { "div",       { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::udivide,             {},         {}           };
-        static const instruction_desc idiv =       { "idiv",      { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::divide,              {},         {}           };
-        static const instruction_desc rem =        { "rem",       { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::uremainder,          {},         {}           };
-        static const instruction_desc irem =       { "irem",      { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::remainder,           {},         {}           };
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*                                              [Id]  [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
+        inline constexpr instruction_desc neg =        { 4,    "neg",       { a::readwrite                                 },    1,            false,    op::negate,              {},         {}           };
+        inline constexpr instruction_desc add =        { 5,    "add",       { a::readwrite,  a::read_any                   },    1,            false,    op::add,                 {},         {}           };
+        inline constexpr instruction_desc sub =        { 6,    "sub",       { a::readwrite,  a::read_any                   },    1,            false,    op::substract,           {},         {}           };
+        inline constexpr instruction_desc mul =        { 7,    "mul",       { a::readwrite,  a::read_any                   },    1,            false,    op::umultiply,           {},         {}           };
+        inline constexpr instruction_desc imul =       { 8,    "imul",      { a::readwrite,  a::read_any                   },    1,            false,    op::multiply,            {},         {}           };
+        inline constexpr instruction_desc mulhi =      { 9,    "mulhi",     { a::readwrite,  a::read_any                   },    1,            false,    op::multiply_high,       {},         {}           };
+        inline constexpr instruction_desc imulhi =     { 10,   "imulhi",    { a::readwrite,  a::read_any                   },    1,            false,    op::umultiply_high,      {},         {}           };
+        inline constexpr instruction_desc div =        { 11,   "div",       { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::udivide,             {},         {}           };
+        inline constexpr instruction_desc idiv =       { 12,   "idiv",      { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::divide,              {},         {}           };
+        inline constexpr instruction_desc rem =        { 13,   "rem",       { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::uremainder,          {},         {}           };
+        inline constexpr instruction_desc irem =       { 14,   "irem",      { a::readwrite,  a::read_any,     a::read_any  },    1,            false,    op::remainder,           {},         {}           };
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
     
         //  -- Bitwise instructions
         //
@@ -92,17 +92,17 @@ namespace vtil
         //    ROR        Reg,    Reg/Imm                                     | OP1 = (OP1>>OP2) | (OP1<<(N-OP2))
         //    ROL        Reg,    Reg/Imm                                     | OP1 = (OP1<<OP2) | (OP1>>(N-OP2))
         //
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
-        /*                                          [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
-        static const instruction_desc bnot =        { "not",      { a::readwrite                                 },    1,          false,      op::bitwise_not,         {},          {}          };
-        static const instruction_desc bshr =        { "shr",      { a::readwrite,  a::read_any                   },    1,          false,      op::shift_right,         {},          {}          };
-        static const instruction_desc bshl =        { "shl",      { a::readwrite,  a::read_any                   },    1,          false,      op::shift_left,          {},          {}          };
-        static const instruction_desc bxor =        { "xor",      { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_xor,         {},          {}          };
-        static const instruction_desc bor =         { "or",       { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_xor,         {},          {}          };
-        static const instruction_desc band =        { "and",      { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_and,         {},          {}          };
-        static const instruction_desc bror =        { "ror",      { a::readwrite,  a::read_any                   },    1,          false,      op::rotate_right,        {},          {}          };
-        static const instruction_desc brol =        { "rol",      { a::readwrite,  a::read_any                   },    1,          false,      op::rotate_left,         {},          {}          };
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*                                              [Id]  [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
+        inline constexpr instruction_desc bnot =        { 15,   "not",      { a::readwrite                                 },    1,          false,      op::bitwise_not,         {},          {}          };
+        inline constexpr instruction_desc bshr =        { 16,   "shr",      { a::readwrite,  a::read_any                   },    1,          false,      op::shift_right,         {},          {}          };
+        inline constexpr instruction_desc bshl =        { 17,   "shl",      { a::readwrite,  a::read_any                   },    1,          false,      op::shift_left,          {},          {}          };
+        inline constexpr instruction_desc bxor =        { 18,   "xor",      { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_xor,         {},          {}          };
+        inline constexpr instruction_desc bor =         { 19,   "or",       { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_xor,         {},          {}          };
+        inline constexpr instruction_desc band =        { 20,   "and",      { a::readwrite,  a::read_any                   },    1,          false,      op::bitwise_and,         {},          {}          };
+        inline constexpr instruction_desc bror =        { 21,   "ror",      { a::readwrite,  a::read_any                   },    1,          false,      op::rotate_right,        {},          {}          };
+        inline constexpr instruction_desc brol =        { 22,   "rol",      { a::readwrite,  a::read_any                   },    1,          false,      op::rotate_left,         {},          {}          };
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
     
         //  -- Control flow instructions
         //                                                            
@@ -111,13 +111,13 @@ namespace vtil
         //    VEXIT      Reg/Imm                                            | Jumps to OP1, continues real execution
         //    VXCALL     Reg/Imm                                            | Calls into OP1, pauses virtual execution until the call returns
         //
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
-        /*                                          [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
-        static const instruction_desc js =         { "js",        { a::read_reg,   a::read_any,     a::read_any    },  2,          true,        {},                     { 1, 2 },    {}          };
-        static const instruction_desc jmp =        { "jmp",       { a::read_any                                    },  1,          true,        {},                     { 1 },       {}          };
-        static const instruction_desc vexit =      { "vexit",     { a::read_any                                    },  1,          true,        {},                     { -1 },      {}          };
-        static const instruction_desc vxcall =     { "vxcall",    { a::read_any                                    },  1,          true,        {},                     {},          {}          };
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*                                              [Id]  [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
+        inline constexpr instruction_desc js =         { 23,   "js",        { a::read_reg,   a::read_any,     a::read_any    },  2,          true,        {},                     { 1, 2 },    {}          };
+        inline constexpr instruction_desc jmp =        { 24,   "jmp",       { a::read_any                                    },  1,          true,        {},                     { 1 },       {}          };
+        inline constexpr instruction_desc vexit =      { 25,   "vexit",     { a::read_any                                    },  1,          true,        {},                     { -1 },      {}          };
+        inline constexpr instruction_desc vxcall =     { 26,   "vxcall",    { a::read_any                                    },  1,          true,        {},                     {},          {}          };
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
 
         //    -- Special instructions
         //
@@ -130,27 +130,51 @@ namespace vtil
         //    VPINRM     Reg,    Imm                                        | Pins the qword @ memory location for read
         //    VPINWM     Reg,    Imm                                        | Pins the qword @ memory location for write
         //
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
-        /*                                          [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
-        static const instruction_desc nop =        { "nop",       {                                             },  0,          false,      {},                      {},         {}           };
-        static const instruction_desc upflg =      { "upflg",     { a::readwrite                                },  1,          false,      {},                      {},         {}           };
-        static const instruction_desc vsetcc =     { "vsetcc",    { a::write,      a::read_imm                  },  1,          false,      {},                      {},         {}           };
-        static const instruction_desc vemit =      { "vemit",     { a::read_imm                                 },  1,          true,       {},                      {},         {}           };
-        static const instruction_desc vpinr =      { "vpinr",     { a::read_reg                                 },  1,          true,       {},                      {},         {}           };
-        static const instruction_desc vpinw =      { "vpinw",     { a::write                                    },  1,          true,       {},                      {},         {}           };
-        static const instruction_desc vpinrm =     { "vpinrm",    { a::read_reg,   a::read_imm,                 },  1,          true,       {},                      {},         { 1, false } };
-        static const instruction_desc vpinwm =     { "vpinwm",    { a::read_reg,   a::read_imm                  },  1,          true,       {},                      {},         { 1, true }  };
-        /*------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
+        /*                                              [Id]  [Name]        [Operands...]                                     [ASizeOp]   [Volatile]  [Operator]               [BranchOps] [MemOps]     */
+        inline constexpr instruction_desc nop =        { 27,   "nop",       {                                             },  0,          false,      {},                      {},         {}           };
+        inline constexpr instruction_desc upflg =      { 28,   "upflg",     { a::readwrite                                },  1,          false,      {},                      {},         {}           };
+        inline constexpr instruction_desc vsetcc =     { 29,   "vsetcc",    { a::write,      a::read_imm                  },  1,          false,      {},                      {},         {}           };
+        inline constexpr instruction_desc vemit =      { 30,   "vemit",     { a::read_imm                                 },  1,          true,       {},                      {},         {}           };
+        inline constexpr instruction_desc vpinr =      { 31,   "vpinr",     { a::read_reg                                 },  1,          true,       {},                      {},         {}           };
+        inline constexpr instruction_desc vpinw =      { 32,   "vpinw",     { a::write                                    },  1,          true,       {},                      {},         {}           };
+        inline constexpr instruction_desc vpinrm =     { 33,   "vpinrm",    { a::read_reg,   a::read_imm,                 },  1,          true,       {},                      {},         { 1, false } };
+        inline constexpr instruction_desc vpinwm =     { 34,   "vpinwm",    { a::read_reg,   a::read_imm                  },  1,          true,       {},                      {},         { 1, true }  };
+        /*----------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------*/
     };
 
-    // List of all instructions.
+    // List of all instructions, indexed by their opcode.
     //
-    static const instruction_desc instruction_list[] = 
+    inline constexpr const instruction_desc* instruction_list[] = 
     {
-        ins::mov, ins::movr, ins::str, ins::ldd, ins::neg, ins::add, ins::sub, ins::mul,
-        ins::imul, ins::mulhi, ins::imulhi, ins::div, ins::idiv, ins::rem, ins::irem, ins::bnot,
-        ins::bshr, ins::bshl, ins::bxor, ins::bor, ins::band, ins::bror, ins::brol, ins::upflg,
-        ins::js, ins::jmp, ins::vexit, ins::vxcall, ins::nop, ins::vsetcc, ins::vemit, 
-        ins::vpinr, ins::vpinw, ins::vpinrm, ins::vpinwm
+        &ins::mov, &ins::movr, &ins::str, &ins::ldd, &ins::neg, &ins::add, &ins::sub, &ins::mul,
+        &ins::imul, &ins::mulhi, &ins::imulhi, &ins::div, &ins::idiv, &ins::rem, &ins::irem, &ins::bnot,
+        &ins::bshr, &ins::bshl, &ins::bxor, &ins::bor, &ins::band, &ins::bror, &ins::brol, &ins::js, 
+        &ins::jmp, &ins::vexit, &ins::vxcall, &ins::nop, &ins::upflg, &ins::vsetcc, &ins::vemit, 
+        &ins::vpinr, &ins::vpinw, &ins::vpinrm, &ins::vpinwm
     };
+    static_assert( [ ] ()
+    {
+        for ( size_t i = 0; i < std::size( instruction_list ); i++ )
+            if ( instruction_list[ i ]->opcode != i )
+                return false;
+        return true;
+    }(), "Instruction list must be indexed by the opcode." );
+
+    // Number of opcodes reserved for the built-in instruction set, user-defined
+    // instructions are assigned opcodes starting from this value.
+    //
+    static constexpr opcode_t first_user_opcode = ( opcode_t ) std::size( instruction_list );
+
+    // Looks up the instruction descriptor registered for the given opcode 
+    // in constant time, returns nullptr if the opcode is not registered.
+    //
+    const instruction_desc* lookup_instruction( opcode_t opcode );
+
+    // Registers a user-defined instruction descriptor under the opcode requested,
+    // or the first free opcode if none is specified, and writes it into the descriptor.
+    // Returns the assigned opcode or invalid_opcode if it collides with an existing one.
+    // - Descriptor must not be destroyed while it is registered.
+    //
+    opcode_t register_instruction( instruction_desc& desc, opcode_t opcode = invalid_opcode );
 };
\ No newline at end of file
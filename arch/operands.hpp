@@ -27,35 +27,58 @@
 //
 #pragma once
 #include <string>
+#include <type_traits>
+#include <vtil/io>
 #include <vtil/math>
 #include "register_desc.hpp"
 
 namespace vtil
 {
-	// Operand structure either holds an immediate or a register.
+	// Type of the value an operand holds.
 	//
+	enum class operand_kind : uint8_t
+	{
+		invalid = 0,
+		reg,
+		immediate,
+	};
+
 	#pragma pack(push, 4)
+	// Describes an immediate value along with its size.
+	//
+	struct immediate_desc
+	{
+		union
+		{
+			int64_t i64;
+			uint64_t u64;
+		};
+		uint8_t bit_count = 0;
+	};
+
+	// Operand structure either holds an immediate or a register, which are
+	// overlapped in memory and discriminated by the operand kind.
+	//
 	struct operand
 	{
-		// If operand is a register:
-		//
-		register_desc reg = {};
+		union
+		{
+			// If operand is a register:
+			//
+			register_desc reg;
 
-		// If operand is an immediate:
+			// If operand is an immediate:
+			//
+			immediate_desc imm;
+		};
+
+		// Kind of the value stored.
 		//
-		struct
-		{
-			union
-			{
-				int64_t i64;
-				uint64_t u64;
-			};
-			bitcnt_t bit_count = 0;
-		} imm;
+		operand_kind kind = operand_kind::invalid;
 
 		// Default constructor / move / copy.
 		//
-		operand() = default;
+		operand() : imm{} {}
 		operand( operand&& ) = default;
 		operand( const operand& ) = default;
 		operand& operator=( operand&& ) = default;
@@ -65,8 +88,13 @@ namespace vtil
 		// followed by an explicit size.
 		//		
 		template<typename T, std::enable_if_t<!std::is_same_v<std::remove_cvref_t<T>, operand>, int> = 0>
-		operand( T&& reg ) : reg( register_cast<std::remove_cvref_t<T>>{}( reg ) ) {}
-		operand( int64_t v, bitcnt_t bit_count ) : imm( { v, bit_count } ) {}
+		operand( T&& reg ) : reg( register_cast<std::remove_cvref_t<T>>{}( reg ) ), kind( operand_kind::reg ) {}
+		operand( int64_t v, bitcnt_t bit_count ) : imm{}, kind( operand_kind::immediate ) 
+		{ 
+			fassert( 0 <= bit_count && bit_count <= 64 );
+			imm.i64 = v;
+			imm.bit_count = ( uint8_t ) bit_count;
+		}
 
 		// Getter for the operand size (in bytes).
 		//
@@ -83,8 +111,8 @@ namespace vtil
 
 		// Simple helpers to determine the type of operand.
 		//
-		bool is_register() const { return reg.is_valid(); }
-		bool is_immediate() const { return imm.bit_count != 0; }
+		bool is_register() const { return kind == operand_kind::reg && reg.is_valid(); }
+		bool is_immediate() const { return kind == operand_kind::immediate && imm.bit_count != 0; }
 		bool is_valid() const 
 		{ 
 			if ( is_register() )
@@ -99,8 +127,24 @@ namespace vtil
 		// Basic comparison operators.
 		//
 		bool operator!=( const operand& o ) const { return !operator==( o ); };
-		bool operator==( const operand& o ) const { return is_register() ? reg == o.reg : ( imm.u64 == o.imm.u64 && imm.bit_count == o.imm.bit_count ); }
-		bool operator<( const operand& o ) const { return is_register() ? reg < o.reg : ( imm.u64 < o.imm.u64 || imm.bit_count < o.imm.bit_count ); }
+		bool operator==( const operand& o ) const 
+		{ 
+			if ( kind != o.kind ) return false;
+			if ( kind == operand_kind::reg ) return reg == o.reg;
+			if ( kind == operand_kind::immediate ) return imm.u64 == o.imm.u64 && imm.bit_count == o.imm.bit_count;
+			return true;
+		}
+		bool operator<( const operand& o ) const 
+		{ 
+			if ( kind != o.kind ) return kind < o.kind;
+			if ( kind == operand_kind::reg ) return reg < o.reg;
+			if ( kind == operand_kind::immediate ) return imm.u64 != o.imm.u64 ? imm.u64 < o.imm.u64 : imm.bit_count < o.imm.bit_count;
+			return false;
+		}
 	};
 	#pragma pack(pop)
+
+	// Operands should fit in 16 bytes.
+	//
+	static_assert( sizeof( operand ) == 16, "Operand must be 16 bytes." );
 };
\ No newline at end of file
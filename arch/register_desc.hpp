@@ -27,6 +27,8 @@
 //
 #pragma once
 #include <string>
+#include <functional>
+#include <vtil/io>
 #include <vtil/math>
 
 namespace vtil
@@ -76,27 +78,80 @@ namespace vtil
 		register_readonly =         1 << 5,
 	};
 
-	// This type describes any register instance.
+	// Number of bits the local identifier of a register can occupy, the
+	// remaining bits are used for the flags when forming the register key.
 	//
-	struct register_desc
+	static constexpr bitcnt_t register_id_bits = 56;
+
+	// Packed canonical key identifying a full register regardless of the bits accessed, 
+	// formed by placing the flags at the top 8 bits and the local identifier at the rest.
+	//
+	struct register_key
 	{
-		// Flags of the current register, as described in "enum register_flag".
+		uint64_t value = ~0ull;
+
+		// Default constructor creates an invalid key.
 		//
-		uint8_t flags;
+		constexpr register_key() = default;
+		constexpr explicit register_key( uint64_t value ) : value( value ) {}
+		constexpr register_key( uint8_t flags, uint64_t local_id ) 
+			: value( ( uint64_t( flags ) << register_id_bits ) | local_id ) {}
+
+		// Decomposition of the key.
+		//
+		constexpr uint8_t flags() const { return uint8_t( value >> register_id_bits ); }
+		constexpr uint64_t local_id() const { return value & ( ( 1ull << register_id_bits ) - 1 ); }
+		constexpr bool is_valid() const { return value != ~0ull; }
 
+		// Hashes the key by mixing all bits of the value, the mixer is bijective
+		// so distinct keys never collide before reduction.
+		//
+		constexpr size_t hash() const
+		{
+			uint64_t x = value;
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccd;
+			x ^= x >> 33;
+			x *= 0xc4ceb9fe1a85ec53;
+			x ^= x >> 33;
+			return ( size_t ) x;
+		}
+
+		// Basic comparison operators.
+		//
+		constexpr bool operator!=( const register_key& o ) const { return value != o.value; }
+		constexpr bool operator==( const register_key& o ) const { return value == o.value; }
+		constexpr bool operator<( const register_key& o ) const { return value < o.value; }
+	};
+
+	// Key used for a register key that is never valid, since no register can be both 
+	// physical and local, used to mark empty slots in the register tables.
+	//
+	static constexpr register_key invalid_register_key = {};
+
+	// This type describes any register instance.
+	// - Packed so that it can overlap an immediate in a 16-byte operand.
+	//
+	#pragma pack(push, 4)
+	struct register_desc
+	{
 		// Arbitrary identifier, is intentionally not universally unique to let ids of user registers make use
-		// of the full 64-bit range as otherwise we'd have to reserve some magic numbers for flags and stack pointer. 
+		// of the full 56-bit range as otherwise we'd have to reserve some magic numbers for flags and stack pointer. 
 		// Due to this reason, flags should also be compared when doing comparison.
 		//
 		size_t local_id;
+
+		// Flags of the current register, as described in "enum register_flag".
+		//
+		uint8_t flags;
 		
 		// Size of the register in bits.
 		//
-		bitcnt_t bit_count = 0;
+		uint8_t bit_count = 0;
 
 		// Offset at which we read from the full 64-bit version.
 		//
-		bitcnt_t bit_offset;
+		uint8_t bit_offset;
 
 		// Default constructor / move / copy.
 		//
@@ -109,8 +164,9 @@ namespace vtil
 		// Construct a fully formed register.
 		//
 		register_desc( uint8_t flags, size_t id, bitcnt_t bit_count, bitcnt_t bit_offset = 0 ) 
-			: flags( flags ), local_id( id ), bit_count( bit_count ), bit_offset( bit_offset ) 
+			: local_id( id ), flags( flags ), bit_count( ( uint8_t ) bit_count ), bit_offset( ( uint8_t ) bit_offset ) 
 		{ 
+			fassert( 0 <= bit_offset && 0 <= bit_count && ( bit_count + bit_offset ) <= 64 );
 			fassert( is_valid() ); 
 		}
 
@@ -123,6 +179,11 @@ namespace vtil
 			if ( bit_count == 0 || ( bit_count + bit_offset ) > 64 )
 				return false;
 
+			// Validate the identifier fits in the register key.
+			//
+			if ( local_id >> register_id_bits )
+				return false;
+
 			// If register holds flags or the stack pointer:
 			//
 			if ( is_stack_pointer() || is_flags() )
@@ -153,6 +214,15 @@ namespace vtil
 		//
 		uint64_t get_mask() const { return math::fill( bit_count, bit_offset ); }
 
+		// Returns the key identifying the full register this descriptor is a slice of.
+		//
+		register_key key() const { return { flags, local_id }; }
+
+		// Returns the bit slice this descriptor accesses packed into a 16-bit integer, 
+		// which together with the key identifies the descriptor exactly.
+		//
+		uint16_t slice() const { return uint16_t( bit_offset ) | ( uint16_t( bit_count ) << 8 ); }
+
 		// Checks whether bits from this register and the other register overlap.
 		//
 		bool overlaps( const register_desc& o ) const 
@@ -197,8 +267,20 @@ namespace vtil
 		//
 		bool operator!=( const register_desc& o ) const { return local_id != o.local_id || flags != o.flags || bit_count != o.bit_count || bit_offset != o.bit_offset; }
 		bool operator==( const register_desc& o ) const { return local_id == o.local_id && flags == o.flags && bit_count == o.bit_count && bit_offset == o.bit_offset; }
-		bool operator<( const register_desc& o ) const  { return local_id < o.local_id  || flags < o.flags  || bit_count < o.bit_count  || bit_offset < o.bit_offset; }
+		bool operator<( const register_desc& o ) const  
+		{ 
+			// Order by the full register first and then by the slice.
+			//
+			if ( flags != o.flags )           return flags < o.flags;
+			if ( local_id != o.local_id )     return local_id < o.local_id;
+			return slice() < o.slice();
+		}
+
+		// Hashes the descriptor by combining the key and the slice.
+		//
+		size_t hash() const { return key().hash() ^ ( size_t( slice() ) * 0x9e3779b97f4a7c15 ); }
 	};
+	#pragma pack(pop)
 
 	// Should be overriden by the user to describe conversion of the
 	// register type they use (e.g. x86_reg for Capstone/Keystone) into
@@ -224,4 +306,20 @@ namespace vtil
 	//
 	static const register_desc REG_FLAGS = register_desc{ register_physical | register_flags,         0, 64, 0 };
 	static const register_desc REG_SP =    register_desc{ register_physical | register_stack_pointer, 0, 64, 0 };
+};
+
+// Make the register types hashable.
+//
+namespace std
+{
+	template<>
+	struct hash<vtil::register_key>
+	{
+		size_t operator()( const vtil::register_key& key ) const { return key.hash(); }
+	};
+	template<>
+	struct hash<vtil::register_desc>
+	{
+		size_t operator()( const vtil::register_desc& reg ) const { return reg.hash(); }
+	};
 };
\ No newline at end of file
@@ -0,0 +1,234 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <type_traits>
+#include "register_desc.hpp"
+
+namespace vtil
+{
+	namespace impl
+	{
+		// Key extraction for the slot types used in the register tables.
+		//
+		static constexpr register_key& key_of( register_key& slot ) { return slot; }
+		static constexpr const register_key& key_of( const register_key& slot ) { return slot; }
+		template<typename V> static constexpr register_key& key_of( std::pair<register_key, V>& slot ) { return slot.first; }
+		template<typename V> static constexpr const register_key& key_of( const std::pair<register_key, V>& slot ) { return slot.first; }
+
+		// Flat open-addressing hash table keyed by register keys, using linear
+		// probing and backward-shift deletion so that no tombstones are needed.
+		// - Slots are marked empty by invalid_register_key.
+		// - Any insertion or erasure invalidates all iterators and references.
+		//
+		template<typename slot_type>
+		struct register_table
+		{
+			// Maximum load factor expressed as a fraction.
+			//
+			static constexpr size_t max_load_num = 3;
+			static constexpr size_t max_load_den = 4;
+			static constexpr size_t min_capacity = 16;
+
+			// Slots and the number of occupied ones.
+			//
+			std::vector<slot_type> slots;
+			size_t entry_count = 0;
+
+			// Iterator skipping the empty slots.
+			//
+			template<typename table_type, typename value_type>
+			struct basic_iterator
+			{
+				using iterator_category = std::forward_iterator_tag;
+				using difference_type = ptrdiff_t;
+				using pointer = value_type*;
+				using reference = value_type&;
+
+				table_type* table = nullptr;
+				size_t index = 0;
+
+				basic_iterator() = default;
+				basic_iterator( table_type* table, size_t index ) : table( table ), index( index ) { skip(); }
+				template<typename X, typename Y>
+				basic_iterator( const basic_iterator<X, Y>& o ) : table( o.table ), index( o.index ) {}
+
+				void skip() { while ( index < table->slots.size() && !key_of( table->slots[ index ] ).is_valid() ) index++; }
+				basic_iterator& operator++() { index++; skip(); return *this; }
+				basic_iterator operator++( int ) { auto s = *this; operator++(); return s; }
+				reference operator*() const { return table->slots[ index ]; }
+				pointer operator->() const { return &table->slots[ index ]; }
+				bool operator==( const basic_iterator& o ) const { return index == o.index; }
+				bool operator!=( const basic_iterator& o ) const { return index != o.index; }
+			};
+			using iterator = basic_iterator<register_table, slot_type>;
+			using const_iterator = basic_iterator<const register_table, const slot_type>;
+
+			// Basic container properties.
+			//
+			size_t size() const { return entry_count; }
+			bool empty() const { return entry_count == 0; }
+			size_t capacity() const { return slots.size(); }
+			iterator begin() { return { this, 0 }; }
+			iterator end() { return { this, slots.size() }; }
+			const_iterator begin() const { return { this, 0 }; }
+			const_iterator end() const { return { this, slots.size() }; }
+			void clear() { slots.clear(); entry_count = 0; }
+
+			// Returns the index of the slot that holds the key or the empty slot it
+			// would be placed in if it is not present, table must not be empty.
+			//
+			size_t probe( register_key key ) const
+			{
+				size_t mask = slots.size() - 1;
+				for ( size_t i = key.hash() & mask;; i = ( i + 1 ) & mask )
+				{
+					const register_key& slot_key = key_of( slots[ i ] );
+					if ( slot_key == key || !slot_key.is_valid() )
+						return i;
+				}
+			}
+
+			// Resizes the table to hold at least the given number of entries without growing.
+			//
+			void reserve( size_t n )
+			{
+				size_t new_capacity = min_capacity;
+				while ( new_capacity * max_load_num < n * max_load_den )
+					new_capacity <<= 1;
+				if ( new_capacity <= slots.size() )
+					return;
+
+				std::vector<slot_type> old_slots( new_capacity, slot_type{} );
+				old_slots.swap( slots );
+				for ( slot_type& slot : old_slots )
+				{
+					if ( key_of( slot ).is_valid() )
+						slots[ probe( key_of( slot ) ) ] = std::move( slot );
+				}
+			}
+
+			// Finds the entry associated with the key.
+			//
+			iterator find( register_key key )
+			{
+				if ( slots.empty() ) return end();
+				size_t i = probe( key );
+				return key_of( slots[ i ] ).is_valid() ? iterator{ this, i } : end();
+			}
+			const_iterator find( register_key key ) const
+			{
+				if ( slots.empty() ) return end();
+				size_t i = probe( key );
+				return key_of( slots[ i ] ).is_valid() ? const_iterator{ this, i } : end();
+			}
+			bool contains( register_key key ) const { return find( key ) != end(); }
+			size_t count( register_key key ) const { return contains( key ) ? 1 : 0; }
+
+			// Inserts the slot if there is no entry with the same key, returns the 
+			// iterator to the entry and whether or not it was inserted.
+			//
+			std::pair<iterator, bool> insert( slot_type slot )
+			{
+				fassert( key_of( slot ).is_valid() );
+				reserve( entry_count + 1 );
+				size_t i = probe( key_of( slot ) );
+				if ( key_of( slots[ i ] ).is_valid() )
+					return { iterator{ this, i }, false };
+				slots[ i ] = std::move( slot );
+				entry_count++;
+				return { iterator{ this, i }, true };
+			}
+
+			// Erases the entry associated with the key, returns the number of entries erased.
+			//
+			size_t erase( register_key key )
+			{
+				if ( slots.empty() ) return 0;
+				size_t mask = slots.size() - 1;
+				size_t i = probe( key );
+				if ( !key_of( slots[ i ] ).is_valid() )
+					return 0;
+
+				// Shift every following entry of the cluster back if the 
+				// hole is between its ideal position and itself.
+				//
+				for ( size_t j = ( i + 1 ) & mask;; j = ( j + 1 ) & mask )
+				{
+					register_key& key_j = key_of( slots[ j ] );
+					if ( !key_j.is_valid() )
+						break;
+					size_t ideal = key_j.hash() & mask;
+					if ( ( ( j - ideal ) & mask ) >= ( ( j - i ) & mask ) )
+					{
+						slots[ i ] = std::move( slots[ j ] );
+						i = j;
+					}
+				}
+				slots[ i ] = slot_type{};
+				entry_count--;
+				return 1;
+			}
+		};
+	};
+
+	// Flat hash set of register keys.
+	//
+	using register_set = impl::register_table<register_key>;
+
+	// Flat hash map from register keys to arbitrary values.
+	//
+	template<typename V>
+	struct register_map : impl::register_table<std::pair<register_key, V>>
+	{
+		using base_type = impl::register_table<std::pair<register_key, V>>;
+
+		// Inserts the value if there is no entry with the same key.
+		//
+		template<typename... Tx>
+		std::pair<typename base_type::iterator, bool> try_emplace( register_key key, Tx&&... args )
+		{
+			auto it = base_type::find( key );
+			if ( it != base_type::end() )
+				return { it, false };
+			return base_type::insert( { key, V( std::forward<Tx>( args )... ) } );
+		}
+
+		// Returns a reference to the value associated with the key, 
+		// default constructing it if it does not exist.
+		//
+		V& operator[]( register_key key ) { return try_emplace( key ).first->second; }
+
+		// Returns a reference to the value associated with the key, which must exist.
+		//
+		V& at( register_key key ) { auto it = base_type::find( key ); fassert( it != base_type::end() ); return it->second; }
+		const V& at( register_key key ) const { auto it = base_type::find( key ); fassert( it != base_type::end() ); return it->second; }
+	};
+};
@@ -0,0 +1,264 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+namespace vtil
+{
+	namespace impl
+	{
+		// Reverses the byte order of an integer.
+		//
+		template<typename T>
+		static constexpr T byteswap( T value )
+		{
+			using U = std::make_unsigned_t<T>;
+			U in = ( U ) value, out = 0;
+			for ( size_t i = 0; i != sizeof( T ); i++, in >>= 8 )
+				out = U( ( out << 8 ) | ( in & 0xFF ) );
+			return ( T ) out;
+		}
+
+		// Converts a scalar between the native and the little-endian byte order, the
+		// conversion is symmetric so the same routine is used in both directions.
+		//
+		template<typename T>
+		static constexpr T to_little_endian( T value )
+		{
+			if constexpr ( std::endian::native == std::endian::little || sizeof( T ) == 1 )
+				return value;
+			else if constexpr ( std::is_enum_v<T> )
+				return T( byteswap( std::underlying_type_t<T>( value ) ) );
+			else
+				return byteswap( value );
+		}
+
+		// Whether arrays of the type can be copied as is into a little-endian buffer.
+		//
+		template<typename T>
+		static constexpr bool is_bulk_copyable_v = std::is_trivially_copyable_v<T> &&
+			( std::endian::native == std::endian::little || sizeof( T ) == 1 );
+
+		// Maps signed integers to unsigned ones so that values of small magnitude
+		// have small encodings regardless of their sign and vice versa.
+		//
+		static constexpr uint64_t zigzag_encode( int64_t value ) { return ( uint64_t( value ) << 1 ) ^ uint64_t( value >> 63 ); }
+		static constexpr int64_t zigzag_decode( uint64_t value ) { return int64_t( value >> 1 ) ^ -int64_t( value & 1 ); }
+	};
+
+	// Writer appending binary data to a contiguous growable buffer, used in place of
+	// writing each field to a stream so that serializing is a series of stores.
+	// - Integers and enumerators are stored in little-endian byte order, any other
+	//   trivially copyable type is stored as is.
+	//
+	struct byte_writer
+	{
+		std::vector<uint8_t> buffer;
+
+		// Returns the current size of the buffer and the buffer itself.
+		//
+		size_t size() const { return buffer.size(); }
+		const uint8_t* data() const { return buffer.data(); }
+
+		// Reserves space for the given number of bytes at the end of the buffer and returns it.
+		//
+		uint8_t* allocate( size_t n )
+		{
+			size_t offset = buffer.size();
+			if ( buffer.capacity() < offset + n )
+				buffer.reserve( std::max( offset + n, buffer.capacity() * 2 ) );
+			buffer.resize( offset + n );
+			return buffer.data() + offset;
+		}
+
+		// Writes raw bytes.
+		//
+		void write_bytes( const void* src, size_t n ) { if ( n ) memcpy( allocate( n ), src, n ); }
+
+		// Writes a single value.
+		//
+		template<typename T>
+		void write( const T& value )
+		{
+			static_assert( std::is_trivially_copyable_v<T>, "Value must be trivially copyable." );
+			if constexpr ( std::is_integral_v<T> || std::is_enum_v<T> )
+			{
+				T le = impl::to_little_endian( value );
+				memcpy( allocate( sizeof( T ) ), &le, sizeof( T ) );
+			}
+			else
+			{
+				memcpy( allocate( sizeof( T ) ), &value, sizeof( T ) );
+			}
+		}
+
+		// Writes an array of values, copying it in bulk if the representation allows it.
+		//
+		template<typename T>
+		void write_array( const T* src, size_t n )
+		{
+			if constexpr ( impl::is_bulk_copyable_v<T> )
+				write_bytes( src, n * sizeof( T ) );
+			else
+				for ( size_t i = 0; i != n; i++ )
+					write( src[ i ] );
+		}
+
+		// Writes an integer as a variable-length quantity, 7 bits per byte starting from
+		// the least significant ones with the top bit indicating that more bytes follow.
+		//
+		void write_varint( uint64_t value )
+		{
+			uint8_t raw[ 10 ];
+			size_t n = 0;
+			for ( ; value >= 0x80; value >>= 7 )
+				raw[ n++ ] = uint8_t( value | 0x80 );
+			raw[ n++ ] = uint8_t( value );
+			write_bytes( raw, n );
+		}
+		void write_svarint( int64_t value ) { write_varint( impl::zigzag_encode( value ) ); }
+
+		// Overwrites a value written previously at the given offset, used to fill in
+		// the length prefixes once the length is known.
+		//
+		template<typename T>
+		void patch( size_t offset, const T& value )
+		{
+			T le = impl::to_little_endian( value );
+			memcpy( buffer.data() + offset, &le, sizeof( T ) );
+		}
+	};
+
+	// Reader consuming binary data written by the byte_writer from a contiguous buffer
+	// it does not own.
+	// - Reads past the end of the buffer yield zeroes and mark the reader failed
+	//   instead of raising an error, so malformed input can be rejected by the caller.
+	//
+	struct byte_reader
+	{
+		const uint8_t* cursor = nullptr;
+		const uint8_t* limit = nullptr;
+		bool failed = false;
+
+		// Construction from a buffer.
+		//
+		byte_reader() = default;
+		byte_reader( const void* data, size_t n ) : cursor( ( const uint8_t* ) data ), limit( ( const uint8_t* ) data + n ) {}
+
+		// Simple state checks.
+		//
+		size_t remaining() const { return limit - cursor; }
+		bool is_valid() const { return !failed; }
+
+		// Consumes the given number of bytes, returning a pointer to them or
+		// null if there are not enough bytes left.
+		//
+		const uint8_t* consume( size_t n )
+		{
+			if ( failed || remaining() < n )
+			{
+				failed = true;
+				cursor = limit;
+				return nullptr;
+			}
+			const uint8_t* p = cursor;
+			cursor += n;
+			return p;
+		}
+
+		// Reads raw bytes.
+		//
+		bool read_bytes( void* dst, size_t n )
+		{
+			const uint8_t* src = consume( n );
+			if ( !src )
+			{
+				memset( dst, 0, n );
+				return false;
+			}
+			if ( n ) memcpy( dst, src, n );
+			return true;
+		}
+
+		// Reads a single value.
+		//
+		template<typename T>
+		void read( T& value )
+		{
+			static_assert( std::is_trivially_copyable_v<T>, "Value must be trivially copyable." );
+			read_bytes( &value, sizeof( T ) );
+			if constexpr ( std::is_integral_v<T> || std::is_enum_v<T> )
+				value = impl::to_little_endian( value );
+		}
+		template<typename T>
+		T read()
+		{
+			T value;
+			read( value );
+			return value;
+		}
+
+		// Reads an array of values, copying it in bulk if the representation allows it.
+		//
+		template<typename T>
+		void read_array( T* dst, size_t n )
+		{
+			if constexpr ( impl::is_bulk_copyable_v<T> )
+				read_bytes( dst, n * sizeof( T ) );
+			else
+				for ( size_t i = 0; i != n; i++ )
+					read( dst[ i ] );
+		}
+
+		// Reads an integer written as a variable-length quantity, fails if the encoding
+		// is truncated or does not fit in 64 bits.
+		//
+		uint64_t read_varint()
+		{
+			uint64_t value = 0;
+			for ( int shift = 0; shift < 64; shift += 7 )
+			{
+				const uint8_t* p = consume( 1 );
+				if ( !p )
+					return 0;
+				value |= uint64_t( *p & 0x7F ) << shift;
+				if ( !( *p & 0x80 ) )
+					return value;
+			}
+			failed = true;
+			cursor = limit;
+			return 0;
+		}
+		int64_t read_svarint() { return impl::zigzag_decode( read_varint() ); }
+	};
+};
\ No newline at end of file
@@ -124,17 +124,20 @@ namespace vtil::debug
 		if ( blk_visited )
 			return;
 
-		// Print each instruction
+		// Print each instruction with the queued stack shifts applied.
 		//
 		int ins_idx = 0;
+		instruction prev;
 		for ( auto it = blk->begin(); it != blk->end(); it++, ins_idx++ )
 		{
+			instruction ins = blk->stream.resolve( it );
 			log<CON_BLU>( "%04d: ", ins_idx );
-			if ( it->vip == invalid_vip )
+			if ( ins.vip == invalid_vip )
 				log<CON_DEF>( "[PSEUDO] " );
 			else
-				log<CON_DEF>( "[%06x] ", it->vip );
-			dump( *it, it.is_begin() ? nullptr : &*std::prev( it ) );
+				log<CON_DEF>( "[%06x] ", ins.vip );
+			dump( ins, it.is_begin() ? nullptr : &prev );
+			prev = std::move( ins );
 		}
 
 		// Dump each branch as well
@@ -144,7 +147,7 @@ namespace vtil::debug
 			visited->insert( blk );
 			log_padding++;
 			log( "\n" );
-			for ( auto& child : blk->next )
+			for ( auto& child : blk->successors() )
 				dump( child, visited );
 			log_padding--;
 			log( "\n" );
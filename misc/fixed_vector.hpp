@@ -0,0 +1,153 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <iterator>
+#include <algorithm>
+#include <initializer_list>
+#include <type_traits>
+#include <vtil/io>
+
+namespace vtil
+{
+	// Vector with a fixed capacity storing its elements inline, used in place of 
+	// std::vector where the number of elements has a small known upper bound so 
+	// that no heap allocations are made and the container can be used in constant
+	// expressions.
+	//
+	template<typename T, size_t N>
+	struct fixed_vector
+	{
+		using value_type = T;
+		using size_type = std::conditional_t<N <= 0xFF, uint8_t, size_t>;
+		using difference_type = ptrdiff_t;
+		using reference = T&;
+		using const_reference = const T&;
+		using pointer = T*;
+		using const_pointer = const T*;
+		using iterator = T*;
+		using const_iterator = const T*;
+
+		// Number of elements stored and the storage itself.
+		//
+		size_type length = 0;
+		T values[ N ] = {};
+
+		// Default constructor / move / copy.
+		//
+		constexpr fixed_vector() = default;
+		constexpr fixed_vector( fixed_vector&& ) = default;
+		constexpr fixed_vector( const fixed_vector& ) = default;
+		constexpr fixed_vector& operator=( fixed_vector&& ) = default;
+		constexpr fixed_vector& operator=( const fixed_vector& ) = default;
+
+		// Construction from a list of values.
+		//
+		constexpr fixed_vector( std::initializer_list<T> list )
+		{
+			for ( auto& value : list )
+				push_back( value );
+		}
+
+		// Capacity related helpers.
+		//
+		static constexpr size_t capacity() { return N; }
+		static constexpr size_t max_size() { return N; }
+		constexpr size_t size() const { return length; }
+		constexpr bool empty() const { return length == 0; }
+
+		// Iterators.
+		//
+		constexpr iterator begin() { return values; }
+		constexpr iterator end() { return values + length; }
+		constexpr const_iterator begin() const { return values; }
+		constexpr const_iterator end() const { return values + length; }
+		constexpr const_iterator cbegin() const { return values; }
+		constexpr const_iterator cend() const { return values + length; }
+
+		// Element access.
+		//
+		constexpr T* data() { return values; }
+		constexpr const T* data() const { return values; }
+		constexpr T& operator[]( size_t n ) { return values[ n ]; }
+		constexpr const T& operator[]( size_t n ) const { return values[ n ]; }
+		constexpr T& front() { return values[ 0 ]; }
+		constexpr const T& front() const { return values[ 0 ]; }
+		constexpr T& back() { return values[ length - 1 ]; }
+		constexpr const T& back() const { return values[ length - 1 ]; }
+
+		// Modifiers.
+		//
+		constexpr void clear() { length = 0; }
+		constexpr void push_back( const T& value )
+		{
+			if ( length == N ) overflow();
+			values[ length++ ] = value;
+		}
+		template<typename... Tx>
+		constexpr T& emplace_back( Tx&&... args )
+		{
+			if ( length == N ) overflow();
+			return values[ length++ ] = T( std::forward<Tx>( args )... );
+		}
+		constexpr void pop_back() { length--; }
+		constexpr void resize( size_t n, const T& value = {} )
+		{
+			if ( n > N ) overflow();
+			for ( size_t i = length; i < n; i++ )
+				values[ i ] = value;
+			length = ( size_type ) n;
+		}
+		constexpr iterator insert( const_iterator pos, const T& value )
+		{
+			if ( length == N ) overflow();
+			iterator it = begin() + ( pos - cbegin() );
+			std::move_backward( it, end(), end() + 1 );
+			*it = value;
+			length++;
+			return it;
+		}
+		constexpr iterator erase( const_iterator pos )
+		{
+			iterator it = begin() + ( pos - cbegin() );
+			std::move( it + 1, end(), it );
+			length--;
+			return it;
+		}
+
+		// Basic comparison operators.
+		//
+		constexpr bool operator==( const fixed_vector& o ) const { return std::equal( begin(), end(), o.begin(), o.end() ); }
+		constexpr bool operator!=( const fixed_vector& o ) const { return !operator==( o ); }
+
+	private:
+		// Raised when the capacity is exceeded, not being a constant expression
+		// it also makes the error a compile-time one in constant evaluation.
+		//
+		static void overflow() { fassert( !"fixed_vector capacity exceeded." ); }
+	};
+};
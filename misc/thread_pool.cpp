@@ -0,0 +1,226 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "thread_pool.hpp"
+
+namespace vtil
+{
+	// Pool and the index of the worker the current thread is, if any.
+	//
+	static thread_local thread_pool* current_pool = nullptr;
+	static thread_local size_t current_index = 0;
+
+	// Creates a pool with the given number of workers, defaults to the hardware concurrency.
+	//
+	thread_pool::thread_pool( size_t thread_count )
+	{
+		if ( !thread_count )
+			thread_count = std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+
+		for ( size_t i = 0; i < thread_count; i++ )
+			queues.emplace_back( std::make_unique<worker_queue>() );
+		for ( size_t i = 0; i < thread_count; i++ )
+			threads.emplace_back( &thread_pool::worker, this, i );
+	}
+	thread_pool::~thread_pool()
+	{
+		// Signal all workers to stop and wait for them to exit.
+		//
+		{
+			std::lock_guard _g( sleep_mutex );
+			stopping = true;
+		}
+		sleep_cv.notify_all();
+		for ( auto& thread : threads )
+			thread.join();
+	}
+
+	// Returns the shared thread pool.
+	//
+	thread_pool& thread_pool::get_default()
+	{
+		static thread_pool pool;
+		return pool;
+	}
+
+	// Queues a task, if invoked from a worker of this pool the task is
+	// pushed to its own queue, otherwise the queues are picked round-robin.
+	//
+	void thread_pool::push( task_type task )
+	{
+		// Increment the counter under the sleep mutex so that a worker that is
+		// about to sleep cannot miss the notification, this is done before the
+		// task is queued so that the counter never goes below zero.
+		//
+		{
+			std::lock_guard _g( sleep_mutex );
+			queued_count++;
+		}
+
+		// Push the task to the picked queue.
+		//
+		size_t index = current_pool == this
+			? current_index
+			: external_index.fetch_add( 1, std::memory_order_relaxed ) % queues.size();
+		{
+			std::lock_guard _g( queues[ index ]->mutex );
+			queues[ index ]->tasks.emplace_back( std::move( task ) );
+		}
+		sleep_cv.notify_one();
+	}
+
+	// Invokes the function for each chunk of the range [0, count) in parallel, blocks
+	// until all chunks are processed.
+	//
+	void thread_pool::parallel_for( size_t count, size_t chunk_size, const std::function<void( size_t begin, size_t end )>& fn )
+	{
+		if ( !count )
+			return;
+		chunk_size = std::max<size_t>( chunk_size, 1 );
+		size_t chunk_count = ( count + chunk_size - 1 ) / chunk_size;
+
+		// If there is a single chunk, invoke the function directly.
+		//
+		if ( chunk_count == 1 )
+			return fn( 0, count );
+
+		// State shared with the helpers, which may outlive this call if 
+		// they are picked up after every chunk is already claimed.
+		//
+		struct shared_state
+		{
+			const std::function<void( size_t, size_t )>* fn;
+			size_t count;
+			size_t chunk_size;
+			size_t chunk_count;
+			std::atomic<size_t> next_chunk = 0;
+			std::atomic<size_t> completed_count = 0;
+			std::mutex mutex;
+			std::condition_variable cv;
+			bool done = false;
+
+			// Claims and processes chunks until there are none left.
+			//
+			void run()
+			{
+				size_t chunk;
+				while ( ( chunk = next_chunk.fetch_add( 1 ) ) < chunk_count )
+				{
+					size_t begin = chunk * chunk_size;
+					( *fn )( begin, std::min( begin + chunk_size, count ) );
+					if ( completed_count.fetch_add( 1 ) + 1 == chunk_count )
+					{
+						std::lock_guard _g( mutex );
+						done = true;
+						cv.notify_all();
+					}
+				}
+			}
+		};
+		auto state = std::make_shared<shared_state>();
+		state->fn = &fn;
+		state->count = count;
+		state->chunk_size = chunk_size;
+		state->chunk_count = chunk_count;
+
+		// Queue a helper for each worker that could be put to use, process 
+		// the chunks on the calling thread as well and wait for completion.
+		//
+		size_t helper_count = std::min( chunk_count - 1, size() );
+		for ( size_t i = 0; i < helper_count; i++ )
+			push( [ state ] () { state->run(); } );
+		state->run();
+
+		std::unique_lock lock( state->mutex );
+		state->cv.wait( lock, [ & ] { return state->done; } );
+	}
+
+	// Tries to pop a task from own queue or steal one from the others.
+	//
+	bool thread_pool::try_pop( size_t index, task_type& out )
+	{
+		// Pop the most recent task from own queue.
+		//
+		{
+			worker_queue& own = *queues[ index ];
+			std::lock_guard _g( own.mutex );
+			if ( !own.tasks.empty() )
+			{
+				out = std::move( own.tasks.back() );
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+
+		// Steal the oldest task from another queue.
+		//
+		for ( size_t n = 1; n < queues.size(); n++ )
+		{
+			worker_queue& victim = *queues[ ( index + n ) % queues.size() ];
+			std::unique_lock _g( victim.mutex, std::try_to_lock );
+			if ( _g.owns_lock() && !victim.tasks.empty() )
+			{
+				out = std::move( victim.tasks.front() );
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Loop each worker runs.
+	//
+	void thread_pool::worker( size_t index )
+	{
+		current_pool = this;
+		current_index = index;
+
+		task_type task;
+		while ( true )
+		{
+			// Run tasks while there are any available.
+			//
+			if ( try_pop( index, task ) )
+			{
+				queued_count--;
+				task();
+				task = nullptr;
+				continue;
+			}
+
+			// Sleep until a task is queued or the pool is stopped, the count is
+			// re-checked since a steal may have failed due to a busy queue lock.
+			//
+			std::unique_lock lock( sleep_mutex );
+			if ( stopping )
+				return;
+			if ( queued_count.load() )
+				continue;
+			sleep_cv.wait( lock, [ & ] { return stopping || queued_count.load() != 0; } );
+		}
+	}
+};
@@ -0,0 +1,107 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+namespace vtil
+{
+	// Work-stealing thread pool, every worker owns a queue it pushes to and pops 
+	// from in LIFO order, idle workers steal the oldest tasks of other workers.
+	//
+	struct thread_pool
+	{
+		using task_type = std::function<void()>;
+
+		// Queue owned by each worker.
+		//
+		struct worker_queue
+		{
+			std::mutex mutex;
+			std::deque<task_type> tasks;
+		};
+
+		// Worker queues and threads.
+		//
+		std::vector<std::unique_ptr<worker_queue>> queues;
+		std::vector<std::thread> threads;
+
+		// Number of tasks queued but not yet picked up, and the state used to put 
+		// idle workers to sleep until new tasks are queued or the pool is stopped.
+		//
+		std::atomic<size_t> queued_count = 0;
+		std::mutex sleep_mutex;
+		std::condition_variable sleep_cv;
+		bool stopping = false;
+
+		// Index of the next queue tasks pushed from outside the pool go to.
+		//
+		std::atomic<size_t> external_index = 0;
+
+		// Creates a pool with the given number of workers, defaults to the hardware concurrency.
+		//
+		thread_pool( size_t thread_count = 0 );
+		thread_pool( const thread_pool& ) = delete;
+		thread_pool& operator=( const thread_pool& ) = delete;
+		~thread_pool();
+
+		// Returns the shared thread pool.
+		//
+		static thread_pool& get_default();
+
+		// Returns the number of workers.
+		//
+		size_t size() const { return threads.size(); }
+
+		// Queues a task, if invoked from a worker of this pool the task is
+		// pushed to its own queue, otherwise the queues are picked round-robin.
+		//
+		void push( task_type task );
+
+		// Invokes the function for each chunk of the range [0, count) in parallel, blocks
+		// until all chunks are processed. The calling thread processes chunks as well so 
+		// this can be safely invoked from within a worker of the pool.
+		//
+		void parallel_for( size_t count, size_t chunk_size, const std::function<void( size_t begin, size_t end )>& fn );
+
+	private:
+		// Tries to pop a task from own queue or steal one from the others.
+		//
+		bool try_pop( size_t index, task_type& out );
+
+		// Loop each worker runs.
+		//
+		void worker( size_t index );
+	};
+};
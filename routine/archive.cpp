@@ -0,0 +1,398 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "archive.hpp"
+#include "serialization.hpp"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vtil
+{
+	static constexpr uint32_t archive_magic = 'ARTV';
+
+	// Reads a little-endian 64-bit integer from the mapping.
+	//
+	static uint64_t read_u64( const uint8_t* p )
+	{
+		uint64_t value;
+		memcpy( &value, p, sizeof( value ) );
+		return impl::to_little_endian( value );
+	}
+
+	// Frees every block created but not materialized or marked invalid, as neither are 
+	// in the explored block table.
+	//
+	routine_archive::lazy_source::~lazy_source()
+	{
+		std::pmr::polymorphic_allocator<basic_block> alloc{ &rtn->allocator };
+		for ( auto& [vip, blk] : created )
+			if ( !blk->is_materialized.load( std::memory_order_relaxed ) || blk->is_invalid )
+				alloc.delete_object( blk );
+	}
+
+	// Returns the entry of the block in the sorted block list, returns nullptr if there is none.
+	//
+	const uint8_t* routine_archive::lazy_source::find_entry( vip_t vip ) const
+	{
+		size_t lo = 0, hi = block_count;
+		while ( lo < hi )
+		{
+			size_t mid = ( lo + hi ) / 2;
+			if ( read_u64( blocks + mid * sizeof( block_entry ) + offsetof( block_entry, entry_vip ) ) < vip )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if ( lo == block_count || read_u64( blocks + lo * sizeof( block_entry ) + offsetof( block_entry, entry_vip ) ) != vip )
+			return nullptr;
+		return blocks + lo * sizeof( block_entry );
+	}
+
+	// Returns the block associated with the VIP creating it without materializing if
+	// it was not yet, returns nullptr if the routine has no such block.
+	//
+	basic_block* routine_archive::lazy_source::reference( vip_t vip )
+	{
+		auto it = created.find( vip );
+		if ( it != created.end() )
+			return it->second;
+		if ( !find_entry( vip ) )
+			return nullptr;
+
+		// Create the block without materializing it.
+		//
+		basic_block* blk = rtn->allocate_block( vip );
+		blk->is_materialized.store( false, std::memory_order_relaxed );
+		created.emplace( vip, blk );
+		return blk;
+	}
+
+	// Decodes the record of the block, references the blocks it links to and registers it in 
+	// the explored block table, returns false and marks the block invalid if the record is corrupt.
+	//
+	bool routine_archive::lazy_source::materialize_locked( basic_block* blk )
+	{
+		if ( blk->is_materialized.load( std::memory_order_relaxed ) )
+			return !blk->is_invalid;
+
+		// Find the record of the block and decode it.
+		//
+		vip_t entry_vip = blk->entry_vip;
+		const uint8_t* entry = find_entry( entry_vip );
+		uint64_t offset = entry ? read_u64( entry + offsetof( block_entry, offset ) ) : archive->length;
+
+		std::vector<vip_t> prev;
+		std::vector<vip_t> next;
+		bool valid = false;
+		if ( offset < archive->length )
+		{
+			byte_reader in = { archive->data + offset, archive->length - offset };
+			valid = deserialize( in, blk, prev, next ) && blk->entry_vip == entry_vip;
+		}
+
+		// Resolve the referenced blocks, creating them if necessary.
+		//
+		std::vector<basic_block*> refs;
+		for ( auto* vips : { &prev, &next } )
+		{
+			for ( size_t n = 0; valid && n != vips->size(); n++ )
+			{
+				basic_block* ref = reference( ( *vips )[ n ] );
+				valid = ref != nullptr;
+				refs.push_back( ref );
+			}
+		}
+
+		// If the record is corrupt, leave the block empty and mark it invalid so that it is 
+		// not decoded again, otherwise link it to the referenced blocks.
+		//
+		if ( !valid )
+		{
+			blk->entry_vip = entry_vip;
+			blk->stream.clear();
+			blk->sp_offset = 0;
+			blk->sp_index = 0;
+			blk->last_temporary_index = 0;
+			blk->is_invalid = true;
+			blk->is_materialized.store( true, std::memory_order_release );
+			return false;
+		}
+		blk->prev.assign( refs.begin(), refs.begin() + prev.size() );
+		blk->next.assign( refs.begin() + prev.size(), refs.end() );
+
+		// Publish the block.
+		//
+		blk->is_materialized.store( true, std::memory_order_release );
+		rtn->explored_blocks.insert( entry_vip, blk );
+		rtn->invalidate_analyses();
+		return true;
+	}
+
+	// Implement the block source.
+	//
+	basic_block* routine_archive::lazy_source::fetch( vip_t vip )
+	{
+		std::lock_guard _g( mutex );
+		basic_block* blk = reference( vip );
+		if ( blk && !materialize_locked( blk ) )
+			return nullptr;
+		return blk;
+	}
+	void routine_archive::lazy_source::materialize( const basic_block* blk )
+	{
+		std::lock_guard _g( mutex );
+		materialize_locked( const_cast< basic_block* >( blk ) );
+	}
+	void routine_archive::lazy_source::fetch_all()
+	{
+		if ( is_complete.load( std::memory_order_acquire ) )
+			return;
+
+		std::lock_guard _g( mutex );
+		for ( size_t n = 0; n != block_count; n++ )
+			materialize_locked( reference( read_u64( blocks + n * sizeof( block_entry ) + offsetof( block_entry, entry_vip ) ) ) );
+		is_complete.store( true, std::memory_order_release );
+	}
+
+	// Unmaps the archive.
+	//
+	routine_archive::~routine_archive()
+	{
+		if ( !data )
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile( data );
+		CloseHandle( mapping );
+#else
+		munmap( ( void* ) data, length );
+#endif
+	}
+
+	// Maps the archive at the given path, returns nullptr if it could not be
+	// mapped or is not a valid archive.
+	//
+	std::shared_ptr<routine_archive> routine_archive::open( const std::string& path )
+	{
+		auto archive = std::make_shared<routine_archive>();
+
+		// Map the file.
+		//
+#ifdef _WIN32
+		HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+		if ( file == INVALID_HANDLE_VALUE )
+			return nullptr;
+		LARGE_INTEGER size;
+		if ( !GetFileSizeEx( file, &size ) || !size.QuadPart )
+		{
+			CloseHandle( file );
+			return nullptr;
+		}
+		archive->mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		CloseHandle( file );
+		if ( !archive->mapping )
+			return nullptr;
+		archive->data = ( const uint8_t* ) MapViewOfFile( archive->mapping, FILE_MAP_READ, 0, 0, 0 );
+		if ( !archive->data )
+		{
+			CloseHandle( archive->mapping );
+			return nullptr;
+		}
+		archive->length = ( size_t ) size.QuadPart;
+#else
+		int fd = ::open( path.c_str(), O_RDONLY );
+		if ( fd < 0 )
+			return nullptr;
+		struct stat st;
+		if ( fstat( fd, &st ) || !st.st_size )
+		{
+			close( fd );
+			return nullptr;
+		}
+		void* base = mmap( nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		close( fd );
+		if ( base == MAP_FAILED )
+			return nullptr;
+		archive->data = ( const uint8_t* ) base;
+		archive->length = ( size_t ) st.st_size;
+#endif
+
+		// Validate the header and the bounds of the routine index.
+		//
+		if ( archive->length < sizeof( header ) )
+			return nullptr;
+		byte_reader in = { archive->data, sizeof( header ) };
+		uint32_t magic = in.read<uint32_t>();
+		uint32_t version = in.read<uint32_t>();
+		uint64_t routine_count = in.read<uint64_t>();
+		uint64_t index_offset = in.read<uint64_t>();
+		if ( magic != archive_magic || version != serialization_version || index_offset > archive->length ||
+			 routine_count > ( archive->length - index_offset ) / sizeof( routine_entry ) )
+			return nullptr;
+
+		archive->routine_count = routine_count;
+		archive->routines = archive->data + index_offset;
+		return archive;
+	}
+
+	// Returns the entry VIP of the routine at the index.
+	//
+	vip_t routine_archive::entry_vip( size_t index ) const
+	{
+		fassert( index < routine_count );
+		return read_u64( routines + index * sizeof( routine_entry ) + offsetof( routine_entry, entry_vip ) );
+	}
+
+	// Creates a routine that loads its blocks from the archive as they are visited,
+	// returns nullptr if the archive has no routine with the given entry VIP.
+	//
+	routine* routine_archive::load( vip_t vip ) const
+	{
+		// Binary search the sorted routine list.
+		//
+		size_t lo = 0, hi = routine_count;
+		while ( lo < hi )
+		{
+			size_t mid = ( lo + hi ) / 2;
+			if ( entry_vip( mid ) < vip )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if ( lo == routine_count || entry_vip( lo ) != vip )
+			return nullptr;
+
+		// Validate the bounds of the block list.
+		//
+		const uint8_t* entry = routines + lo * sizeof( routine_entry );
+		uint64_t block_count = read_u64( entry + offsetof( routine_entry, block_count ) );
+		uint64_t blocks_offset = read_u64( entry + offsetof( routine_entry, blocks_offset ) );
+		if ( blocks_offset > length || block_count > ( length - blocks_offset ) / sizeof( block_entry ) )
+			return nullptr;
+
+		// Create the routine, attach the source and fetch the entry point.
+		//
+		routine* rtn = new routine;
+		rtn->source = std::make_unique<lazy_source>( shared_from_this(), rtn, data + blocks_offset, block_count );
+		rtn->explored_blocks.source = rtn->source.get();
+		rtn->entry_point = rtn->explored_blocks.find( vip );
+		if ( !rtn->entry_point )
+		{
+			delete rtn;
+			return nullptr;
+		}
+		return rtn;
+	}
+
+	// Writes the routines into an archive at the given path encoding the block records
+	// as described by the options, returns whether it succeeded.
+	//
+	bool routine_archive::write( const std::string& path, const std::vector<const routine*>& routines, const serialization_options& options )
+	{
+		std::ofstream out( path, std::ios::binary | std::ios::trunc );
+		if ( !out )
+			return false;
+
+		// Sort the routines by their entry VIP.
+		//
+		std::vector<const routine*> sorted = routines;
+		std::sort( sorted.begin(), sorted.end(), [ ] ( const routine* a, const routine* b )
+		{
+			return a->entry_point->entry_vip < b->entry_point->entry_vip;
+		} );
+
+		// Reserve space for the header, it is written once the index is.
+		//
+		uint64_t offset = sizeof( header );
+		const char zero[ sizeof( header ) ] = {};
+		out.write( zero, sizeof( zero ) );
+
+		// Write the blocks of each routine, saving their offsets.
+		//
+		std::vector<std::vector<std::pair<vip_t, uint64_t>>> block_lists;
+		for ( const routine* rtn : sorted )
+		{
+			rtn->materialize_all();
+
+			byte_writer buffer;
+			auto& list = block_lists.emplace_back();
+			for ( auto& [vip, blk] : rtn->explored_blocks )
+			{
+				list.emplace_back( vip, offset + buffer.size() );
+				serialize( buffer, blk, options );
+			}
+			std::sort( list.begin(), list.end() );
+			out.write( ( const char* ) buffer.data(), buffer.size() );
+			offset += buffer.size();
+		}
+
+		// Write the index aligned to 8 bytes, routine list followed by the block lists.
+		//
+		byte_writer index;
+		index.allocate( ( 8 - offset % 8 ) % 8 );
+		uint64_t index_offset = offset + index.size();
+		uint64_t blocks_offset = index_offset + sorted.size() * sizeof( routine_entry );
+		for ( size_t n = 0; n != sorted.size(); n++ )
+		{
+			index.write<uint64_t>( sorted[ n ]->entry_point->entry_vip );
+			index.write<uint64_t>( block_lists[ n ].size() );
+			index.write<uint64_t>( blocks_offset );
+			blocks_offset += block_lists[ n ].size() * sizeof( block_entry );
+		}
+		for ( auto& list : block_lists )
+		{
+			for ( auto& [vip, block_offset] : list )
+			{
+				index.write<uint64_t>( vip );
+				index.write<uint64_t>( block_offset );
+			}
+		}
+		out.write( ( const char* ) index.data(), index.size() );
+
+		// Write the header.
+		//
+		byte_writer head;
+		head.write<uint32_t>( archive_magic );
+		head.write<uint32_t>( serialization_version );
+		head.write<uint64_t>( sorted.size() );
+		head.write<uint64_t>( index_offset );
+		out.seekp( 0 );
+		out.write( ( const char* ) head.data(), head.size() );
+		return out.good();
+	}
+};
\ No newline at end of file
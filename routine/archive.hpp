@@ -0,0 +1,158 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "routine.hpp"
+#include "basic_block.hpp"
+#include "serialization.hpp"
+
+namespace vtil
+{
+	// Archive of serialized routines, mapped into memory and loaded lazily.
+	// - The file starts with a header pointing to an index of the routines sorted by their
+	//   entry VIP, each routine entry points to the list of its blocks sorted by their entry
+	//   VIP, which holds the offset of the block record as serialized by serialization.hpp.
+	// - Routines loaded from the archive only materialize the blocks they visit, blocks are
+	//   materialized when they are looked up in the explored block table or reached through
+	//   ::successors() and ::predecessors(), see basic_block::materialize.
+	//
+	struct routine_archive : std::enable_shared_from_this<routine_archive>
+	{
+		// Entries of the index as stored in the file, every field is a little-endian 64-bit integer.
+		//
+		struct routine_entry
+		{
+			uint64_t entry_vip;
+			uint64_t block_count;
+			uint64_t blocks_offset;
+		};
+		struct block_entry
+		{
+			uint64_t entry_vip;
+			uint64_t offset;
+		};
+
+		// Header of the archive.
+		//
+		struct header
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint64_t routine_count;
+			uint64_t index_offset;
+		};
+
+		// Source of the blocks of a routine loaded from the archive.
+		//
+		struct lazy_source : block_source
+		{
+			// Archive the blocks are loaded from, kept alive as long as the routine is.
+			//
+			std::shared_ptr<const routine_archive> archive;
+
+			// Routine being loaded and the sorted list of its blocks within the archive.
+			//
+			routine* rtn;
+			const uint8_t* blocks;
+			size_t block_count;
+
+			// Every block created by the source so far, materialized or not, and the
+			// mutex guarding it along with the materialization of blocks.
+			//
+			std::mutex mutex;
+			std::unordered_map<vip_t, basic_block*> created;
+			std::atomic<bool> is_complete = false;
+
+			lazy_source( std::shared_ptr<const routine_archive> archive, routine* rtn, const uint8_t* blocks, size_t block_count )
+				: archive( std::move( archive ) ), rtn( rtn ), blocks( blocks ), block_count( block_count ) {}
+			~lazy_source();
+
+			// Implement the block source.
+			//
+			basic_block* fetch( vip_t vip ) override;
+			void materialize( const basic_block* blk ) override;
+			void fetch_all() override;
+
+		private:
+			// Returns the entry of the block in the sorted block list, returns nullptr if there is none.
+			//
+			const uint8_t* find_entry( vip_t vip ) const;
+
+			// Returns the block associated with the VIP creating it without materializing if
+			// it was not yet, returns nullptr if the routine has no such block, as well as
+			// materializing a block which returns false and marks it invalid if its record is 
+			// corrupt, must be called with the mutex held.
+			//
+			basic_block* reference( vip_t vip );
+			bool materialize_locked( basic_block* blk );
+		};
+
+		// Mapping of the file.
+		//
+		const uint8_t* data = nullptr;
+		size_t length = 0;
+		void* mapping = nullptr;
+
+		// Number of routines and their index.
+		//
+		size_t routine_count = 0;
+		const uint8_t* routines = nullptr;
+
+		// Archives are created via ::open(...) and cannot be copied.
+		//
+		routine_archive() = default;
+		routine_archive( const routine_archive& ) = delete;
+		routine_archive& operator=( const routine_archive& ) = delete;
+		~routine_archive();
+
+		// Maps the archive at the given path, returns nullptr if it could not be
+		// mapped or is not a valid archive.
+		//
+		static std::shared_ptr<routine_archive> open( const std::string& path );
+
+		// Writes the routines into an archive at the given path encoding the block records
+		// as described by the options, returns whether it succeeded.
+		//
+		static bool write( const std::string& path, const std::vector<const routine*>& routines, const serialization_options& options = {} );
+
+		// Returns the number of routines and the entry VIP of the routine at the index.
+		//
+		size_t size() const { return routine_count; }
+		vip_t entry_vip( size_t index ) const;
+
+		// Creates a routine that loads its blocks from the archive as they are visited,
+		// returns nullptr if the archive has no routine with the given entry VIP.
+		//
+		routine* load( vip_t entry_vip ) const;
+	};
+};
\ No newline at end of file
@@ -26,12 +26,12 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #include "basic_block.hpp"
+#include <optional>
 //#include <vtil/amd64>
 
 namespace vtil
 {
-	// Constructor does not exist. Should be created either using
-	// ::begin(...) or ->fork(...).
+	// Blocks should be created either using ::begin(...) or ->fork(...).
 	//
 	basic_block* basic_block::begin( vip_t entry_vip )
 	{
@@ -39,16 +39,13 @@ namespace vtil
 		//
 		fassert( entry_vip != invalid_vip );
 
-		// Create the basic block with depth = 0, identifier = "0"
+		// Create the routine and the basic block with depth = 0, identifier = "0"
+		// within its arena, and assign this block as the entry-point.
 		//
-		basic_block* blk = new basic_block;
-		blk->entry_vip = entry_vip;
-
-		// Create the routine and assign this block as the entry-point
-		//
-		blk->owner = new routine;
-		blk->owner->entry_point = blk;
-		blk->owner->explored_blocks[ entry_vip ] = blk;
+		routine* rtn = new routine;
+		basic_block* blk = rtn->allocate_block( entry_vip );
+		rtn->entry_point = blk;
+		rtn->explored_blocks.insert( entry_vip, blk );
 
 		// Return the block
 		//
@@ -65,29 +62,45 @@ namespace vtil
 		//
 		fassert( entry_vip != invalid_vip );
 
-		// Check if the routine has already explored this block.
+		// Check if the routine has already explored this block, which is
+		// the common case and does not require any synchronization.
 		//
-		std::lock_guard g( owner->mutex );
 		basic_block* result = nullptr;
-		basic_block*& entry = owner->explored_blocks[ entry_vip ];
+		basic_block* entry = owner->explored_blocks.find( entry_vip );
 		if ( !entry )
 		{
-			// If it did not, create a block and assign it.
+			// If it did not, create a block and try to publish it, if another
+			// thread published a block for the same VIP in the meanwhile, drop 
+			// ours and link to the existing one instead.
 			//
-			result = new basic_block;
-			result->owner = owner;
-			result->entry_vip = entry_vip;
-			result->sp_offset = 0;
-			entry = result;
+			basic_block* blk = owner->allocate_block( entry_vip );
+			auto [existing, inserted] = owner->explored_blocks.insert( entry_vip, blk );
+			if ( inserted )
+				result = blk;
+			else
+				std::pmr::polymorphic_allocator<basic_block>{ &owner->allocator }.delete_object( blk );
+			entry = existing;
 		}
 
-		// Fix the links and quit the scope holding the lock.
+		// Fix the links, only the .prev list of the destination is shared.
 		//
 		next.push_back( entry );
+		entry->lock_prev();
 		entry->prev.push_back( this );
+		entry->unlock_prev();
+		owner->cfg_epoch++;
+		owner->reachability.on_edge( this, entry );
 		return result;
 	}
 
+	// Acquires the lock guarding .prev.
+	//
+	void basic_block::lock_prev()
+	{
+		while ( prev_lock.test_and_set( std::memory_order_acquire ) )
+			owner->edge_contention_count.fetch_add( 1, std::memory_order_relaxed );
+	}
+
 	// Helpers for the allocation of unique temporary registers
 	//
 	register_desc basic_block::tmp( uint8_t size )
@@ -122,9 +135,36 @@ namespace vtil
 			ins.sp_reset = true;
 		}
 
-		// Append the instruction to the stream.
+		// Append the instruction to the stream and index it if the index was created.
 		//
 		stream.push_back( ins );
+		if ( def_use )
+			def_use->update();
+	}
+
+	// Queries of the register accesses, see def_use.hpp.
+	//
+	basic_block::iterator basic_block::next_access( const const_iterator& from, const register_desc& reg, uint8_t mask )
+	{
+		if ( !def_use )
+			def_use = std::make_unique<def_use_index>( &stream );
+		return { this, def_use->next_access( from, reg, mask ) };
+	}
+	basic_block::iterator basic_block::prev_access( const const_iterator& from, const register_desc& reg, uint8_t mask )
+	{
+		if ( !def_use )
+			def_use = std::make_unique<def_use_index>( &stream );
+		return { this, def_use->prev_access( from, reg, mask ) };
+	}
+
+	// Returns the structural hash of the stream, see block_hash.hpp.
+	//
+	uint64_t basic_block::hash()
+	{
+		materialize();
+		if ( !hasher )
+			hasher = std::make_unique<stream_hash>( &stream );
+		return hasher->get();
 	}
 
 	// Queues a stack shift.
@@ -141,49 +181,33 @@ namespace vtil
 
 			// Decrement stack index for each instruction afterwards.
 			//
-			for ( auto i = std::next( it ); !i.is_end(); i++ )
-				i->sp_index--;
+			stream.shift( std::next( it ), stream.end(), { 0, -1 } );
 			sp_index--;
 
 			// Remove the reset flag and merge the offsets.
 			//
-			it->sp_reset = false;
-			offset += it->sp_offset;
-			it->sp_offset = 0;
+			stream.set_reset( it, false );
+			int64_t it_offset = stream.resolve( it ).sp_offset;
+			offset += it_offset;
+			it->sp_offset -= it_offset;
 		}
 
-		// If an iterator is provided, shift the stack pointer
-		// for every instruction that precedes it as well.
+		// If an iterator is provided, shift the stack pointer for every instruction 
+		// from it up to and including the first one of the next stack instance, that 
+		// is the one following the instruction resetting the stack pointer, the shift 
+		// is queued in the stream and applied lazily, see instruction_stream::shift.
+		// If there is no such instruction, the rest of the block is shifted along 
+		// with the stack pointer of the block itself.
 		//
-		std::optional<uint32_t> sp_index_prev;
-		while ( !it.is_end() )
+		if ( !it.is_end() )
 		{
-			// Shift the stack offset accordingly.
-			//
-			it->sp_offset += offset;
-
-			// If instruction reads from SP:
-			//
-			if ( it->reads_from( REG_SP ) )
+			auto last = stream.next_reset( it );
+			if ( last != stream.end() && std::next( last ) != stream.end() )
 			{
-				// If LDR|STR with memory base SP:
-				//
-				if ( it->base->accesses_memory() && it->operands[ it->base->memory_operand_index ].reg.is_stack_pointer() )
-				{
-					// Assert the offset operand is an immediate and 
-					// shift the offset as well.
-					//
-					fassert( it->operands[ it->base->memory_operand_index + 1 ].is_immediate() );
-					it->operands[ it->base->memory_operand_index + 1 ].imm.i64 += offset;
-				}
-			}
-
-			// If stack changed changed, return, else forward the iterator.
-			//
-			if ( sp_index_prev.value_or( it->sp_index ) != it->sp_index )
+				stream.shift( it, std::next( last, 2 ), { offset, 0 } );
 				return this;
-			sp_index_prev = it->sp_index;
-			++it;
+			}
+			stream.shift( it, stream.end(), { offset, 0 } );
 		}
 
 		// Shift the stack pointer and continue as usual
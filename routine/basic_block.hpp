@@ -26,13 +26,16 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
-#include <set>
-#include <list>
 #include <vector>
+#include <memory>
+#include <memory_resource>
 #include <algorithm>
 #include <iterator>
 #include "routine.hpp"
 #include "instruction.hpp"
+#include "instruction_stream.hpp"
+#include "def_use.hpp"
+#include "block_hash.hpp"
 
 namespace vtil
 {
@@ -41,8 +44,8 @@ namespace vtil
 	//   fashion, this structure contains no mutexes at all.
 	//
 	// - During the translation phase, only .prev links should be
-	//   accessed, under the strict condition that owning routine's
-	//   mutex is held by the accesser. For the sake of "basic" 
+	//   accessed, under the strict condition that the block's prev
+	//   lock is held by the accesser. For the sake of "basic" 
 	//   expression simplification in order to resolve branch destinations
 	//   or stack pointer value when required.
 	//
@@ -63,16 +66,18 @@ namespace vtil
 			//
 			container_type* container = nullptr;
 
-			// Path restriction state.
+			// Path restriction state, shared between all iterators derived from
+			// this one since it is never modified once it is created.
 			//
 			bool is_path_restricted = false;
-			std::set<container_type*> paths_allowed;
+			std::shared_ptr<const block_set> paths_allowed;
 
 			// Default constructor and the block-bound constructor.
 			//
-			riterator_base() = default;
+			riterator_base() {}
 			riterator_base( container_type* ref, const iterator_type& i ): container( ref ), iterator_type( i ) {}
-			template<typename X, typename Y> riterator_base( const riterator_base<X, Y>& o ) : container( o.container ), iterator_type( Y( o ) ) {}
+			template<typename X, typename Y> riterator_base( const riterator_base<X, Y>& o ) 
+				: container( o.container ), iterator_type( Y( o ) ), is_path_restricted( o.is_path_restricted ), paths_allowed( o.paths_allowed ) {}
 
 			// Override equality operators to check container first.
 			//
@@ -85,37 +90,12 @@ namespace vtil
 			bool is_begin() const { return !container || iterator_type::operator==( ( iterator_type ) container->stream.begin() ); }
 			bool is_valid() const { return !is_begin() || !is_end(); }
 
-			// Simple helper used to trace paths towards a container.
+			// Simple helper used to trace paths towards a container, returns the set of blocks
+			// that are on a path from the source to the destination.
 			//
-			static std::set<container_type*> path_to( container_type* src, container_type* dst,
-													  bool forward, std::set<container_type*> path = {} )
+			static block_set path_to( container_type* src, container_type* dst, bool forward )
 			{
-				// If we've already tried this path, fail.
-				//
-				if ( path.find( src ) != path.end() )
-					return {};
-
-				// Insert <src> into path.
-				//
-				path.insert( src );
-
-				// If we reached our destination, report success.
-				//
-				if ( src == dst )
-					return path;
-
-				// Otherwise, recurse.
-				//
-				std::set<container_type*> paths_allowed;
-				for ( container_type* blk : ( forward ? src->next : src->prev ) )
-				{
-					// If path ended up at destination, mark all paths "allowed".
-					//
-					std::set<container_type*> path_taken = path_to( blk, dst, forward, path );
-					if ( !path_taken.empty() )
-						paths_allowed.insert( path_taken.begin(), path_taken.end() );
-				}
-				return paths_allowed;
+				return src->owner->reachability.path_to( src, dst, forward );
 			}
 
 			// Restricts the way current iterator can recurse in, making sure
@@ -125,44 +105,37 @@ namespace vtil
 			{
 				// Trace the path.
 				//
-				std::set<container_type*> trace = path_to( container, dst, forward );
-				
-				// If path is already restricted:
+				block_set trace = path_to( container, dst, forward );
+
+				// If path is already restricted, any allowed path should be allowed 
+				// in both now, otherwise set as the current allowed paths list.
 				//
 				if ( is_path_restricted )
-				{
-					// Any allowed path should be allowed in both now. 
-					//
-					std::set<container_type*> path_intersection;
-					std::set_intersection( trace.begin(), trace.end(), 
-										   paths_allowed.begin(), paths_allowed.end(), 
-										   std::inserter( path_intersection, path_intersection.begin() ) );
-					paths_allowed = path_intersection;
-				}
-				else
-				{
-					// Set as the current allowed paths list.
-					//
-					paths_allowed = trace;
-				}
+					trace &= *paths_allowed;
+				paths_allowed = std::make_shared<const block_set>( std::move( trace ) );
 
 				// Declare the current iterator path restricted.
 				//
 				is_path_restricted = true;
 			}
 
+			// Returns whether or not the iterator can recurse into the container.
+			//
+			bool is_path_allowed( container_type* dst ) const { return !is_path_restricted || paths_allowed->contains( dst->index ); }
+
 			// Returns the possible paths the iterator can follow if it reaches it's end.
+			// - See traversal.hpp for a lazy alternative walking the instructions directly.
 			//
 			std::vector<riterator_base> recurse( bool forward ) const
 			{
 				// Generate a list of possible iterators to continue from:
 				//
 				std::vector<riterator_base> output;
-				for ( container_type* dst : ( forward ? container->next : container->prev ) )
+				for ( container_type* dst : ( forward ? container->successors() : container->predecessors() ) )
 				{
 					// Skip if path is restricted and this path is not allowed.
 					//
-					if ( is_path_restricted && paths_allowed.find( dst ) == paths_allowed.end() )
+					if ( !is_path_allowed( dst ) )
 						continue;
 
 					// Otherwise create the new iterator, inheriting the path restrictions 
@@ -176,13 +149,17 @@ namespace vtil
 				return output;
 			}
 		};
-		using iterator = riterator_base<basic_block, std::list<instruction>::iterator>;
-		using const_iterator = riterator_base<const basic_block, std::list<instruction>::const_iterator>;
+		using iterator = riterator_base<basic_block, instruction_stream::iterator>;
+		using const_iterator = riterator_base<const basic_block, instruction_stream::const_iterator>;
 
 		// Routine that this basic block belongs to.
 		//
 		routine* owner = nullptr;
 		
+		// Index of the block within the routine, see routine::next_block_index.
+		//
+		uint32_t index = 0;
+
 		// Virtual instruction pointer to the first instruction this 
 		// block originated from. Looking up the instruction stream 
 		// will not do the job here in-case of any skipped or 
@@ -193,7 +170,12 @@ namespace vtil
 		// List of all basic blocks that may possibly 
 		// jump to this basic block.
 		//
-		std::vector<basic_block*> prev = {};
+		std::pmr::vector<basic_block*> prev;
+
+		// Spinlock guarding .prev during the translation phase, blocks are only ever
+		// added to the list so the critical sections are a single push_back.
+		//
+		std::atomic_flag prev_lock = ATOMIC_FLAG_INIT;
 
 		// The offset of current stack pointer from the last 
 		// [MOV SP, <>] if applicable, or the beginning of 
@@ -205,37 +187,81 @@ namespace vtil
 		// List of all basic blocks that this basic
 		// block may possibly jump to.
 		//
-		std::vector<basic_block*> next = {};
+		std::pmr::vector<basic_block*> next;
 
 		// List of all instructions in the stream. This structure
 		// is represented as a list instead to make all references
 		// to it valid even if an element is appended/removed.
 		//
-		std::list<instruction> stream = {};
+		instruction_stream stream;
 
 		// Last temporary index used.
 		//
 		uint32_t last_temporary_index = 0;
 
-		// Wrap the std::list fundamentals.
+		// Index of the register accesses in the stream, created on the first query.
+		//
+		std::unique_ptr<def_use_index> def_use;
+
+		// Structural hash of the stream, created on the first query.
 		//
-		inline auto size() const { return stream.size(); }
-		inline iterator end() { return { this, stream.end() }; }
-		inline iterator begin() { return { this, stream.begin() }; }
-		inline const_iterator end() const { return { this, stream.end() }; }
-		inline const_iterator begin() const { return { this, stream.begin() }; }
+		std::unique_ptr<stream_hash> hasher;
+
+		// Whether the stream and the edges of the block are loaded, blocks of routines loaded 
+		// lazily are created without them when they are first referenced, see archive.hpp.
+		//
+		std::atomic<bool> is_materialized = true;
+
+		// Set if the block could not be materialized as its record is corrupt, in which case 
+		// the stream and the edges are left empty and the block is not in the explored block table.
+		//
+		bool is_invalid = false;
+
+		// Loads the stream and the edges of the block if they are not loaded yet. Blocks reached 
+		// via .next and .prev must be materialized before their fields are accessed directly, 
+		// which the instruction stream and edge wrappers below do.
+		//
+		void materialize() const
+		{
+			if ( !is_materialized.load( std::memory_order_acquire ) )
+				owner->source->materialize( this );
+		}
+
+		// Wrap the instruction stream fundamentals.
+		//
+		inline auto size() const { materialize(); return stream.size(); }
+		inline iterator end() { materialize(); return { this, stream.end() }; }
+		inline iterator begin() { materialize(); return { this, stream.begin() }; }
+		inline const_iterator end() const { materialize(); return { this, stream.end() }; }
+		inline const_iterator begin() const { materialize(); return { this, stream.begin() }; }
+
+		// Wrap the edges, the lists of a block that is not materialized are empty.
+		//
+		inline const auto& successors() const { materialize(); return next; }
+		inline const auto& predecessors() const { materialize(); return prev; }
 
 		// Returns whether or not block is complete, a complete
 		// block ends with a branching instruction.
 		//
-		inline bool is_complete() const { return !stream.empty() && stream.back().base->is_branching(); }
+		inline bool is_complete() const { materialize(); return !stream.empty() && stream.back().base->is_branching(); }
 		
-		// Constructor does not exist. Should be created either using
-		// ::begin(...) or ->fork(...).
+		// Constructor should not be invoked directly, blocks should be created
+		// either using ::begin(...) or ->fork(...) which allocate them within the 
+		// routine arena that the containers of the block are bound to as well.
 		//
+		basic_block( routine* owner, vip_t entry_vip ) 
+			: owner( owner ), index( owner->next_block_index++ ), entry_vip( entry_vip ), 
+			  prev( &owner->allocator ), next( &owner->allocator ), stream( &owner->allocator ) {}
+		basic_block( const basic_block& ) = delete;
+		basic_block& operator=( const basic_block& ) = delete;
 		static basic_block* begin( vip_t entry_vip );
 		basic_block* fork( vip_t entry_vip );
 
+		// Acquires and releases the lock guarding .prev.
+		//
+		void lock_prev();
+		void unlock_prev() { prev_lock.clear( std::memory_order_release ); }
+
 		// Helpers for the allocation of unique temporary registers
 		//
 		register_desc tmp( uint8_t size );
@@ -249,6 +275,25 @@ namespace vtil
 		//
 		void append_instruction( instruction ins );
 
+		// Returns the first instruction at or after the position that accesses the register in any of 
+		// the ways in the mask, or the end of the block if there is none. See def_use.hpp.
+		//
+		iterator next_access( const const_iterator& from, const register_desc& reg, uint8_t mask );
+		iterator next_read( const const_iterator& from, const register_desc& reg ) { return next_access( from, reg, access_read ); }
+		iterator next_write( const const_iterator& from, const register_desc& reg ) { return next_access( from, reg, access_write ); }
+
+		// Returns the last instruction before the position that accesses the register in any of 
+		// the ways in the mask, or the end of the block if there is none. See def_use.hpp.
+		//
+		iterator prev_access( const const_iterator& from, const register_desc& reg, uint8_t mask );
+		iterator prev_read( const const_iterator& from, const register_desc& reg ) { return prev_access( from, reg, access_read ); }
+		iterator prev_write( const const_iterator& from, const register_desc& reg ) { return prev_access( from, reg, access_write ); }
+
+		// Returns the structural hash of the stream, rehashing only the instructions appended
+		// since the last query unless it was otherwise modified. See block_hash.hpp.
+		//
+		uint64_t hash();
+
 		// Lazy wrappers for every instruction
 		//
 		template<typename _T>
@@ -270,7 +315,7 @@ namespace vtil
 		template<typename... Ts>																								                \
 		basic_block* x ( Ts&&... operands )																						                \
 		{																														                \
-			append_instruction( instruction{ &ins:: x, std::vector<operand>( { prepare_operand(std::forward<Ts>(operands))... } ) } );			\
+			append_instruction( instruction{ &ins:: x, { prepare_operand(std::forward<Ts>(operands))... } } );					                \
 			return this;																										                \
 		}
 		WRAP_LAZY( mov );
@@ -308,10 +353,21 @@ namespace vtil
 		WRAP_LAZY( vpinwm );
 #undef WRAP_LAZY
 
-		// Queues a stack shift.
+		// Queues a stack shift, shifting the instructions from the iterator up to the end of 
+		// their stack instance as well if given. Shift of the instructions is not applied 
+		// immediately, see sp_offset_at, sp_index_at and normalize_sp.
 		//
 		basic_block* shift_sp( int64_t offset, bool merge_instance = false, iterator it = {} );
 
+		// Returns the stack pointer offset and index of the instruction with the queued shifts applied.
+		//
+		int64_t sp_offset_at( const const_iterator& it ) const { return it->sp_offset + stream.pending_shift( it ).offset; }
+		uint32_t sp_index_at( const const_iterator& it ) const { return uint32_t( it->sp_index + stream.pending_shift( it ).index ); }
+
+		// Applies the queued shifts to every instruction.
+		//
+		void normalize_sp() { stream.normalize(); }
+
 		// Pushes current flags value up the stack queueing the
 		// shift in stack pointer.
 		//
@@ -0,0 +1,237 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "block_hash.hpp"
+#include "basic_block.hpp"
+#include <algorithm>
+
+namespace vtil
+{
+	// Initial value of the hash and the mixer combining a value into it, the 
+	// mixer is a bijective finalizer so that the order of the values matters.
+	//
+	static constexpr uint64_t hash_seed = 0x9e3779b97f4a7c15;
+	static uint64_t combine( uint64_t hash, uint64_t value )
+	{
+		uint64_t x = ( hash + hash_seed ) ^ value;
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111eb;
+		x ^= x >> 31;
+		return x;
+	}
+
+	// Returns the register with the identifier assigned to it if it is local, assigning
+	// the next one if it was not seen before.
+	//
+	register_desc local_renaming::operator()( const register_desc& reg )
+	{
+		if ( !reg.is_local() )
+			return reg;
+
+		auto [it, inserted] = ids.try_emplace( reg.key(), order.size() );
+		if ( inserted )
+			order.push_back( reg.key() );
+
+		register_desc out = reg;
+		out.local_id = it->second;
+		return out;
+	}
+
+	// Hashes a single instruction.
+	//
+	void stream_hash::hash( const instruction& ins )
+	{
+		value = combine( value, uint64_t( ins.base->opcode ) | 
+						 ( uint64_t( ins.operands.size() ) << 16 ) | 
+						 ( uint64_t( ins.sp_reset ) << 24 ) | 
+						 ( uint64_t( ins.explicit_volatile ) << 25 ) );
+		value = combine( value, uint64_t( ins.sp_offset ) );
+		value = combine( value, ins.sp_index );
+
+		for ( auto& op : ins.operands )
+		{
+			if ( op.kind == operand_kind::reg )
+			{
+				register_desc reg = locals( op.reg );
+				value = combine( value, reg.key().value );
+				value = combine( value, ( uint64_t( op.kind ) << 16 ) | reg.slice() );
+			}
+			else if ( op.kind == operand_kind::immediate )
+			{
+				value = combine( value, ( uint64_t( op.kind ) << 16 ) | op.imm.bit_count );
+				if ( !normalize_immediates )
+					value = combine( value, op.imm.u64 );
+			}
+			else
+			{
+				value = combine( value, uint64_t( op.kind ) << 16 );
+			}
+		}
+	}
+
+	// Brings the hash up to date with the stream and returns it.
+	//
+	void stream_hash::update()
+	{
+		// If the stream was edited or shifted, rehash from scratch.
+		//
+		if ( edit_epoch != stream->edit_epoch || shift_epoch != stream->shift_epoch )
+		{
+			locals.clear();
+			value = hash_seed;
+			edit_epoch = stream->edit_epoch;
+			shift_epoch = stream->shift_epoch;
+			last_hashed = &stream->head;
+		}
+
+		// Hash the instructions appended since the last update, resolving the pending shifts.
+		//
+		for ( auto* it = last_hashed->next; it != &stream->head; it = it->next )
+		{
+			hash( stream->resolve( { it } ) );
+			last_hashed = it;
+		}
+	}
+
+	// Returns the canonical form of the block using the renaming given.
+	//
+	static block_dedupe_cache::canonical_block canonicalize( const basic_block* blk, local_renaming& renaming )
+	{
+		block_dedupe_cache::canonical_block out;
+		out.sp_offset = blk->sp_offset;
+		out.sp_index = blk->sp_index;
+		out.instructions.reserve( blk->size() );
+
+		blk->stream.enumerate_resolved( [ & ] ( const instruction& ins )
+		{
+			instruction& copy = out.instructions.emplace_back( ins );
+			for ( auto& op : copy.operands )
+				if ( op.kind == operand_kind::reg )
+					op.reg = renaming( op.reg );
+			if ( !copy.is_pseudo() )
+				copy.vip -= blk->entry_vip;
+		} );
+		out.locals = renaming.order;
+		return out;
+	}
+
+	// Checks whether the canonical forms of two blocks are equal.
+	//
+	static bool is_equal( const block_dedupe_cache::canonical_block& a, const block_dedupe_cache::canonical_block& b )
+	{
+		if ( a.sp_offset != b.sp_offset || a.sp_index != b.sp_index || a.instructions.size() != b.instructions.size() )
+			return false;
+		return std::equal( a.instructions.begin(), a.instructions.end(), b.instructions.begin(), [ ] ( const instruction& x, const instruction& y )
+		{
+			return x == y && x.sp_offset == y.sp_offset && x.sp_index == y.sp_index && 
+				   x.sp_reset == y.sp_reset && x.explicit_volatile == y.explicit_volatile;
+		} );
+	}
+
+	// Returns the canonical form of the block and writes its hash.
+	//
+	block_dedupe_cache::canonical_block block_dedupe_cache::canonicalize( const basic_block* blk, uint64_t& hash )
+	{
+		// Hash the stream, which renames the local registers in the same order the 
+		// canonical form does.
+		//
+		stream_hash hasher = { &blk->stream };
+		blk->materialize();
+		hash = hasher.get();
+		return vtil::canonicalize( blk, hasher.locals );
+	}
+
+	// Replaces the stream of the block with the optimized body of a block structurally equal 
+	// to it if there is one, returns whether it was found.
+	//
+	bool block_dedupe_cache::apply( basic_block* blk )
+	{
+		uint64_t hash;
+		canonical_block form = canonicalize( blk, hash );
+
+		// Find the entry of a structurally equal block.
+		//
+		std::lock_guard _g( mutex );
+		auto [begin, end] = entries.equal_range( hash );
+		auto it = std::find_if( begin, end, [ & ] ( auto& pair ) { return is_equal( pair.second.original, form ); } );
+		if ( it == end )
+			return false;
+		const entry& match = it->second;
+
+		// Map the local registers of the original block to the ones of this block, 
+		// allocating temporaries for the ones introduced by the optimizer.
+		//
+		std::vector<uint64_t> ids;
+		for ( register_key key : form.locals )
+			ids.push_back( key.local_id() );
+		while ( ids.size() < match.optimized.locals.size() )
+			ids.push_back( blk->last_temporary_index++ );
+
+		// Replace the stream with the optimized body, rebasing the VIP's.
+		//
+		blk->stream.clear();
+		for ( const instruction& ins : match.optimized.instructions )
+		{
+			instruction copy = ins;
+			for ( auto& op : copy.operands )
+				if ( op.kind == operand_kind::reg && op.reg.is_local() )
+					op.reg.local_id = ids[ op.reg.local_id ];
+			if ( !copy.is_pseudo() )
+				copy.vip += blk->entry_vip;
+			blk->stream.push_back( copy );
+		}
+		blk->sp_offset = match.optimized.sp_offset;
+		blk->sp_index = match.optimized.sp_index;
+		return true;
+	}
+
+	// Records the optimized body of the block, given the hash and the canonical form of the 
+	// block taken before the optimization. Existing entries are kept as is.
+	//
+	void block_dedupe_cache::insert( uint64_t hash, canonical_block&& original, const basic_block* optimized )
+	{
+		// Rename the local registers of the body starting with the ones of the original 
+		// block, so that they keep their identifiers.
+		//
+		local_renaming renaming;
+		for ( register_key key : original.locals )
+		{
+			renaming.ids.try_emplace( key, renaming.order.size() );
+			renaming.order.push_back( key );
+		}
+		canonical_block body = vtil::canonicalize( optimized, renaming );
+
+		// Insert the entry unless a structurally equal block was inserted in the meantime.
+		//
+		std::lock_guard _g( mutex );
+		auto [begin, end] = entries.equal_range( hash );
+		if ( std::none_of( begin, end, [ & ] ( auto& pair ) { return is_equal( pair.second.original, original ); } ) )
+			entries.emplace( hash, entry{ std::move( original ), std::move( body ) } );
+	}
+};
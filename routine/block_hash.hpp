@@ -0,0 +1,175 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "instruction_stream.hpp"
+#include "..\arch\register_map.hpp"
+
+namespace vtil
+{
+	struct basic_block;
+
+	// Renaming of the local registers, assigning identifiers in the order they are first seen.
+	//
+	struct local_renaming
+	{
+		// Identifiers assigned and the keys in the order they were assigned.
+		//
+		register_map<uint64_t> ids;
+		std::vector<register_key> order;
+
+		// Returns the register with the identifier assigned to it if it is local, assigning
+		// the next one if it was not seen before.
+		//
+		register_desc operator()( const register_desc& reg );
+
+		// Resets the renaming.
+		//
+		void clear() { ids.clear(); order.clear(); }
+	};
+
+	// Structural hash of an instruction stream, equal for streams performing the same operations
+	// regardless of where they were lifted from.
+	// - Opcodes, operands and stack pointer details of the instructions are hashed, VIP's are not.
+	// - Local registers are renamed in the order they first appear, so that the identifiers 
+	//   of the temporaries do not affect the hash.
+	// - Values of the immediates are optionally left out, hashing only their size.
+	// - Instructions appended to the stream are hashed incrementally on the next query, any other
+	//   modification or stack pointer shift is detected via the epochs of the stream and causes it
+	//   to be rehashed, modifying the operands of an instruction in place however is not detected
+	//   and requires an explicit call to ::invalidate().
+	//
+	struct stream_hash
+	{
+		// Stream hashed, whether the immediates are normalized and the state of the hash.
+		//
+		const instruction_stream* stream;
+		bool normalize_immediates;
+		uint64_t edit_epoch = ~0ull;
+		uint64_t shift_epoch = ~0ull;
+		const instruction_stream::node_links* last_hashed = nullptr;
+		uint64_t value = 0;
+
+		// Renaming of the local registers.
+		//
+		local_renaming locals;
+
+		// Construction.
+		//
+		stream_hash( const instruction_stream* stream, bool normalize_immediates = false ) 
+			: stream( stream ), normalize_immediates( normalize_immediates ) {}
+
+		// Drops the hash so that it is recomputed on the next query.
+		//
+		void invalidate() { edit_epoch = ~0ull; }
+
+		// Brings the hash up to date with the stream and returns it.
+		//
+		void update();
+		uint64_t get() { update(); return value; }
+
+	private:
+		// Hashes a single instruction.
+		//
+		void hash( const instruction& ins );
+	};
+
+	// Cache of optimized block bodies keyed by the structural hash of the blocks they were optimized
+	// from, so that blocks repeated across routines, such as the handlers of a virtual machine, are
+	// optimized once and then shared.
+	// - Entries are looked up by the hash with the immediates kept and verified by comparing the
+	//   instructions with the local registers renamed.
+	// - When a body is applied to a block, the local registers of the original block are mapped to
+	//   the ones they correspond to in the block, the ones introduced by the optimizer are allocated
+	//   as new temporaries, and the VIP's are rebased onto the entry VIP of the block.
+	// - Safe to use from multiple threads as long as each block is accessed by one.
+	//
+	struct block_dedupe_cache
+	{
+		// Canonical form of a block, with the local registers renamed and the VIP's made relative 
+		// to the entry VIP, along with the stack pointer details of the block and the keys of the 
+		// local registers in the order they were renamed.
+		//
+		struct canonical_block
+		{
+			std::vector<instruction> instructions;
+			int64_t sp_offset = 0;
+			uint32_t sp_index = 0;
+			std::vector<register_key> locals;
+		};
+
+		// Optimized body and the form of the block it was optimized from.
+		//
+		struct entry
+		{
+			canonical_block original;
+			canonical_block optimized;
+		};
+
+		// Mutex guarding the entries.
+		//
+		mutable std::mutex mutex;
+		std::unordered_multimap<uint64_t, entry> entries;
+
+		// Returns the canonical form of the block and writes its hash.
+		//
+		static canonical_block canonicalize( const basic_block* blk, uint64_t& hash );
+
+		// Replaces the stream of the block with the optimized body of a block structurally equal 
+		// to it if there is one, returns whether it was found.
+		//
+		bool apply( basic_block* blk );
+
+		// Records the optimized body of the block, given the hash and the canonical form of the 
+		// block taken before the optimization. Existing entries are kept as is.
+		//
+		void insert( uint64_t hash, canonical_block&& original, const basic_block* optimized );
+
+		// Invokes the optimizer on the block unless the body of a structurally equal block is cached,
+		// in which case it is applied instead, returns whether the optimizer was invoked.
+		//
+		template<typename T>
+		bool optimize( basic_block* blk, T&& optimizer )
+		{
+			if ( apply( blk ) )
+				return false;
+
+			uint64_t hash;
+			canonical_block original = canonicalize( blk, hash );
+			optimizer( blk );
+			insert( hash, std::move( original ), blk );
+			return true;
+		}
+
+		// Returns the number of entries.
+		//
+		size_t size() const { std::lock_guard _g( mutex ); return entries.size(); }
+	};
+};
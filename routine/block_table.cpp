@@ -0,0 +1,129 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "block_table.hpp"
+
+namespace vtil
+{
+	// Inserts the block if there is no block associated with the VIP yet, returns the 
+	// block associated after the operation and whether or not it was inserted.
+	//
+	std::pair<basic_block*, bool> block_table::insert( vip_t vip, basic_block* block )
+	{
+		uint64_t h = hash( vip );
+		entry* new_entry = nullptr;
+
+		level* lvl = &root;
+		for ( size_t depth = 0; depth < max_depth; )
+		{
+			std::atomic<uintptr_t>& slot = lvl->slots[ index_of( h, depth ) ];
+			uintptr_t value = slot.load( std::memory_order_acquire );
+
+			// If slot is empty, try to place a new entry.
+			//
+			if ( !value )
+			{
+				if ( !new_entry )
+					new_entry = create<entry>( entry{ { vip, block } } );
+				if ( slot.compare_exchange_strong( value, ( uintptr_t ) new_entry, std::memory_order_acq_rel ) )
+				{
+					entry_count.fetch_add( 1, std::memory_order_relaxed );
+					return { block, true };
+				}
+				contention_count.fetch_add( 1, std::memory_order_relaxed );
+				continue;
+			}
+
+			// If slot points to another level, descend.
+			//
+			if ( is_level( value ) )
+			{
+				lvl = as_level( value );
+				depth++;
+				continue;
+			}
+
+			// If slot holds an entry with the same VIP, report the existing block.
+			//
+			entry* existing = as_entry( value );
+			if ( existing->kv.first == vip )
+			{
+				if ( new_entry )
+				{
+					destroy( new_entry );
+					contention_count.fetch_add( 1, std::memory_order_relaxed );
+				}
+				return { existing->kv.second, false };
+			}
+
+			// Otherwise split the slot into a new level holding the existing entry,
+			// the hashes must differ at a deeper level since the mixer is bijective.
+			//
+			fassert( depth + 1 < max_depth );
+			level* split = create<level>();
+			split->slots[ index_of( hash( existing->kv.first ), depth + 1 ) ].store( value, std::memory_order_relaxed );
+			if ( !slot.compare_exchange_strong( value, ( uintptr_t ) split | level_tag, std::memory_order_acq_rel ) )
+			{
+				destroy( split );
+				contention_count.fetch_add( 1, std::memory_order_relaxed );
+			}
+		}
+		fassert( false );
+		return { nullptr, false };
+	}
+
+	// Removes all entries, must not be invoked concurrently with any other operation.
+	//
+	void block_table::clear()
+	{
+		for ( auto& slot : root.slots )
+		{
+			uintptr_t value = slot.exchange( 0, std::memory_order_relaxed );
+			if ( !value ) 
+				continue;
+			if ( is_level( value ) )
+				destroy_level( as_level( value ) );
+			else
+				destroy( as_entry( value ) );
+		}
+		entry_count = 0;
+	}
+	void block_table::destroy_level( level* lvl )
+	{
+		for ( auto& slot : lvl->slots )
+		{
+			uintptr_t value = slot.load( std::memory_order_relaxed );
+			if ( !value ) 
+				continue;
+			if ( is_level( value ) )
+				destroy_level( as_level( value ) );
+			else
+				destroy( as_entry( value ) );
+		}
+		destroy( lvl );
+	}
+};
@@ -0,0 +1,240 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <atomic>
+#include <utility>
+#include <iterator>
+#include <memory_resource>
+#include "instruction.hpp"
+
+namespace vtil
+{
+	// Forward declaration of basic block.
+	//
+	struct basic_block;
+
+	// Source of the blocks of a routine that are loaded lazily, such as an archive, 
+	// see archive.hpp for more information.
+	//
+	struct block_source
+	{
+		// Returns the block associated with the VIP after materializing it, 
+		// returns nullptr if the source has no such block or it could not be materialized.
+		//
+		virtual basic_block* fetch( vip_t vip ) = 0;
+
+		// Materializes the block, which must have been created by this source.
+		//
+		virtual void materialize( const basic_block* blk ) = 0;
+
+		// Materializes every block of the source.
+		//
+		virtual void fetch_all() = 0;
+
+		virtual ~block_source() = default;
+	};
+
+	// Concurrent table mapping virtual instruction pointers to basic blocks, implemented as
+	// a hash trie where every level indexes the next few bits of the hashed VIP. Lookups 
+	// never take a lock and insertions are done via compare-and-swap, an occupied slot is 
+	// split into a deeper level when another VIP has to be inserted in it.
+	// - Entries are immutable and never removed, so references to them stay valid.
+	// - Since the hash is bijective, the iteration order depends only on the set of VIPs
+	//   stored, not on the order they were inserted in.
+	//
+	struct block_table
+	{
+		using value_type = std::pair<const vip_t, basic_block*>;
+
+		// Number of hash bits indexed per level and the resulting level size.
+		//
+		static constexpr size_t level_bits = 6;
+		static constexpr size_t level_size = 1ull << level_bits;
+		static constexpr size_t max_depth = ( 64 + level_bits - 1 ) / level_bits;
+
+		// Slots hold either nothing, a pointer to an entry or a tagged 
+		// pointer to the next level.
+		//
+		struct entry { value_type kv; };
+		struct level { std::atomic<uintptr_t> slots[ level_size ] = {}; };
+		static constexpr uintptr_t level_tag = 1;
+
+		static bool is_level( uintptr_t slot ) { return slot & level_tag; }
+		static level* as_level( uintptr_t slot ) { return ( level* ) ( slot & ~level_tag ); }
+		static entry* as_entry( uintptr_t slot ) { return ( entry* ) slot; }
+
+		// Hashes the VIP, the mixer is bijective so that every VIP has a unique path.
+		//
+		static uint64_t hash( vip_t vip )
+		{
+			uint64_t x = vip;
+			x ^= x >> 30;
+			x *= 0xbf58476d1ce4e5b9;
+			x ^= x >> 27;
+			x *= 0x94d049bb133111eb;
+			x ^= x >> 31;
+			return x;
+		}
+		static size_t index_of( uint64_t hash, size_t depth ) { return ( hash >> ( depth * level_bits ) ) & ( level_size - 1 ); }
+
+		// Memory resource the entries and the levels are allocated from.
+		//
+		std::pmr::memory_resource* resource;
+
+		// Source consulted when a lookup misses, if the routine is loaded lazily.
+		//
+		block_source* source = nullptr;
+
+		// Root level and the number of entries.
+		//
+		level root;
+		std::atomic<size_t> entry_count = 0;
+
+		// Number of times an operation had to retry due to a concurrent modification
+		// of the same slot, or lost an insertion race.
+		//
+		std::atomic<size_t> contention_count = 0;
+
+		// Iterator walking the trie depth-first.
+		//
+		struct iterator
+		{
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = block_table::value_type;
+			using difference_type = ptrdiff_t;
+			using pointer = value_type*;
+			using reference = value_type&;
+
+			// Stack of levels and the slot index within each.
+			//
+			const level* levels[ max_depth ] = {};
+			size_t indices[ max_depth ] = {};
+			int depth = -1;
+			entry* current = nullptr;
+
+			iterator() {}
+			iterator( const level* root ) { levels[ 0 ] = root; indices[ 0 ] = -1; depth = 0; advance(); }
+
+			// Moves to the next entry.
+			//
+			void advance()
+			{
+				while ( depth >= 0 )
+				{
+					// Pop the level if exhausted.
+					//
+					if ( ++indices[ depth ] == level_size )
+					{
+						depth--;
+						continue;
+					}
+
+					// Descend into levels, stop at entries.
+					//
+					uintptr_t slot = levels[ depth ]->slots[ indices[ depth ] ].load( std::memory_order_acquire );
+					if ( !slot ) 
+						continue;
+					if ( is_level( slot ) )
+					{
+						depth++;
+						levels[ depth ] = as_level( slot );
+						indices[ depth ] = -1;
+						continue;
+					}
+					current = as_entry( slot );
+					return;
+				}
+				current = nullptr;
+			}
+
+			iterator& operator++() { advance(); return *this; }
+			iterator operator++( int ) { auto s = *this; advance(); return s; }
+			reference operator*() const { return current->kv; }
+			pointer operator->() const { return &current->kv; }
+			bool operator==( const iterator& o ) const { return current == o.current; }
+			bool operator!=( const iterator& o ) const { return current != o.current; }
+		};
+		using const_iterator = iterator;
+
+		// Construction and destruction, the table cannot be copied or moved.
+		//
+		block_table( std::pmr::memory_resource* resource = std::pmr::get_default_resource() ) : resource( resource ) {}
+		block_table( const block_table& ) = delete;
+		block_table& operator=( const block_table& ) = delete;
+		~block_table() { clear(); }
+
+		// Basic container properties.
+		//
+		size_t size() const { return entry_count.load( std::memory_order_relaxed ); }
+		bool empty() const { return size() == 0; }
+		iterator begin() const { return { &root }; }
+		iterator end() const { return {}; }
+
+		// Finds the block associated with the VIP, returns nullptr if there is none.
+		// - If the block is not found and there is a source, it is fetched from it.
+		//
+		basic_block* find( vip_t vip ) const
+		{
+			uint64_t h = hash( vip );
+			const level* lvl = &root;
+			for ( size_t depth = 0;; depth++ )
+			{
+				uintptr_t slot = lvl->slots[ index_of( h, depth ) ].load( std::memory_order_acquire );
+				if ( !slot )
+					break;
+				if ( !is_level( slot ) )
+				{
+					if ( as_entry( slot )->kv.first == vip )
+						return as_entry( slot )->kv.second;
+					break;
+				}
+				lvl = as_level( slot );
+			}
+			return source ? source->fetch( vip ) : nullptr;
+		}
+		bool contains( vip_t vip ) const { return find( vip ) != nullptr; }
+
+		// Inserts the block if there is no block associated with the VIP yet, returns the 
+		// block associated after the operation and whether or not it was inserted.
+		//
+		std::pair<basic_block*, bool> insert( vip_t vip, basic_block* block );
+
+		// Removes all entries, must not be invoked concurrently with any other operation.
+		//
+		void clear();
+
+	private:
+		// Helpers used to allocate and free the trie nodes.
+		//
+		template<typename T, typename... Tx>
+		T* create( Tx&&... args ) { return std::pmr::polymorphic_allocator<T>{ resource }.template new_object<T>( std::forward<Tx>( args )... ); }
+		template<typename T>
+		void destroy( T* p ) { std::pmr::polymorphic_allocator<T>{ resource }.delete_object( p ); }
+		void destroy_level( level* lvl );
+	};
+};
@@ -0,0 +1,142 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "def_use.hpp"
+#include <algorithm>
+
+namespace vtil
+{
+	// Indexes a single instruction.
+	//
+	void def_use_index::index( instruction_stream::node_links* node )
+	{
+		auto* n = static_cast< instruction_stream::node* >( node );
+		const instruction& ins = n->value;
+
+		for ( int i = 0; i < ins.base->access_types.size(); i++ )
+		{
+			if ( !ins.operands[ i ].is_register() )
+				continue;
+
+			// Determine the access kind.
+			//
+			operand_access type = ins.base->access_types[ i ];
+			uint8_t mask = 0;
+			if ( type != operand_access::write ) mask |= access_read;
+			if ( type >= operand_access::write ) mask |= access_write;
+			if ( type == operand_access::write ) mask |= access_overwrite;
+
+			// Merge with the previous entry if the same instruction accesses the register multiple times.
+			//
+			std::vector<access>& list = accesses[ ins.operands[ i ].reg.key() ];
+			if ( !list.empty() && list.back().node == node )
+				list.back().mask |= mask;
+			else
+				list.push_back( { n->ordinal, node, mask } );
+		}
+	}
+
+	// Brings the index up to date with the stream.
+	//
+	void def_use_index::update()
+	{
+		// If the stream was edited, rebuild from scratch.
+		//
+		if ( edit_epoch != stream->edit_epoch )
+		{
+			accesses.clear();
+			edit_epoch = stream->edit_epoch;
+			last_indexed = &stream->head;
+		}
+
+		// Index the instructions appended since the last update.
+		//
+		for ( auto* it = last_indexed->next; it != &stream->head; it = it->next )
+		{
+			index( it );
+			last_indexed = it;
+		}
+	}
+
+	// Checks whether the instruction accesses the register in any of the ways in the mask.
+	//
+	bool def_use_index::matches( const instruction& ins, const register_desc& reg, uint8_t mask )
+	{
+		return ( ( mask & access_read ) && ins.reads_from( reg ) ) ||
+			   ( ( mask & access_write ) && ins.writes_to( reg ) ) ||
+			   ( ( mask & access_overwrite ) && ins.overwrites( reg ) );
+	}
+
+	// Returns the first instruction at or after the position that accesses the register in any of the 
+	// ways in the mask, or the end of the stream if there is none.
+	//
+	instruction_stream::iterator def_use_index::next_access( instruction_stream::const_iterator from, const register_desc& reg, uint8_t mask )
+	{
+		auto* end = const_cast< instruction_stream::node_links* >( &stream->head );
+		update();
+
+		auto it = accesses.find( reg.key() );
+		if ( it == accesses.end() )
+			return { end };
+
+		// Find the first access at or after the position and check each one from there on.
+		//
+		const std::vector<access>& list = it->second;
+		uint64_t ordinal = stream->ordinal( from );
+		auto a = std::lower_bound( list.begin(), list.end(), ordinal, [ ] ( const access& e, uint64_t o ) { return e.ordinal < o; } );
+		for ( ; a != list.end(); ++a )
+			if ( ( a->mask & mask ) && matches( static_cast< instruction_stream::node* >( a->node )->value, reg, mask ) )
+				return { a->node };
+		return { end };
+	}
+
+	// Returns the last instruction before the position that accesses the register in any of the 
+	// ways in the mask, or the end of the stream if there is none.
+	//
+	instruction_stream::iterator def_use_index::prev_access( instruction_stream::const_iterator from, const register_desc& reg, uint8_t mask )
+	{
+		auto* end = const_cast< instruction_stream::node_links* >( &stream->head );
+		update();
+
+		auto it = accesses.find( reg.key() );
+		if ( it == accesses.end() )
+			return { end };
+
+		// Find the first access at or after the position and check each one before it.
+		//
+		const std::vector<access>& list = it->second;
+		uint64_t ordinal = stream->ordinal( from );
+		auto a = std::lower_bound( list.begin(), list.end(), ordinal, [ ] ( const access& e, uint64_t o ) { return e.ordinal < o; } );
+		while ( a != list.begin() )
+		{
+			--a;
+			if ( ( a->mask & mask ) && matches( static_cast< instruction_stream::node* >( a->node )->value, reg, mask ) )
+				return { a->node };
+		}
+		return { end };
+	}
+};
@@ -0,0 +1,104 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include "instruction_stream.hpp"
+#include "..\arch\register_map.hpp"
+
+namespace vtil
+{
+	// Kinds of register accesses, combined as a mask.
+	//
+	enum register_access_mask : uint8_t
+	{
+		access_read = 1 << 0,
+		access_write = 1 << 1,
+		access_overwrite = 1 << 2,
+	};
+
+	// Index of the register accesses in an instruction stream, mapping each register to the ordered
+	// list of instructions accessing any part of it, so that the next or the previous access of a 
+	// register from a position can be found using a binary search.
+	// - Instructions appended to the stream are indexed incrementally on the next query.
+	// - Any other modification of the stream is detected via its edit epoch and causes the index
+	//   to be rebuilt, modifying the operands of an instruction in place however is not detected 
+	//   and requires an explicit call to ::invalidate().
+	//
+	struct def_use_index
+	{
+		// Single instruction accessing the register.
+		//
+		struct access
+		{
+			uint64_t ordinal;
+			instruction_stream::node_links* node;
+			uint8_t mask;
+		};
+
+		// Stream indexed and the state of the index.
+		//
+		const instruction_stream* stream;
+		uint64_t edit_epoch = ~0ull;
+		const instruction_stream::node_links* last_indexed = nullptr;
+
+		// List of accesses for each register.
+		//
+		register_map<std::vector<access>> accesses;
+
+		// Construction.
+		//
+		def_use_index( const instruction_stream* stream ) : stream( stream ) {}
+
+		// Drops the index so that it is rebuilt on the next query.
+		//
+		void invalidate() { edit_epoch = ~0ull; }
+
+		// Brings the index up to date with the stream.
+		//
+		void update();
+
+		// Returns the first instruction at or after the position that accesses the register in any of the 
+		// ways in the mask, or the end of the stream if there is none.
+		//
+		instruction_stream::iterator next_access( instruction_stream::const_iterator from, const register_desc& reg, uint8_t mask );
+
+		// Returns the last instruction before the position that accesses the register in any of the 
+		// ways in the mask, or the end of the stream if there is none.
+		//
+		instruction_stream::iterator prev_access( instruction_stream::const_iterator from, const register_desc& reg, uint8_t mask );
+
+	private:
+		// Indexes a single instruction.
+		//
+		void index( instruction_stream::node_links* node );
+
+		// Checks whether the instruction accesses the register in any of the ways in the mask.
+		//
+		static bool matches( const instruction& ins, const register_desc& reg, uint8_t mask );
+	};
+};
@@ -0,0 +1,244 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "dominance.hpp"
+#include "basic_block.hpp"
+
+namespace vtil
+{
+	// Builds the tree using the Lengauer-Tarjan algorithm for the graph of the given size, given 
+	// the root and callbacks enumerating the successors and the predecessors of a node.
+	//
+	template<typename successor_enumerator, typename predecessor_enumerator>
+	void dominator_tree::build( size_t node_count, uint32_t root, successor_enumerator&& successors, predecessor_enumerator&& predecessors )
+	{
+		// Number the nodes in depth-first order, all arrays below are indexed by this number.
+		//
+		std::vector<uint32_t> number( node_count, invalid_node );
+		std::vector<uint32_t> vertex;
+		std::vector<uint32_t> parent;
+		{
+			std::vector<std::pair<uint32_t, uint32_t>> stack = { { root, invalid_node } };
+			while ( !stack.empty() )
+			{
+				auto [n, from] = stack.back();
+				stack.pop_back();
+				if ( number[ n ] != invalid_node )
+					continue;
+				number[ n ] = vertex.size();
+				vertex.push_back( n );
+				parent.push_back( from );
+				successors( n, [ & ] ( uint32_t s ) { if ( number[ s ] == invalid_node ) stack.push_back( { s, number[ n ] } ); } );
+			}
+		}
+		size_t count = vertex.size();
+
+		// Compute the semi-dominators in reverse order using path compression, 
+		// deferring the computation of immediate dominators via buckets.
+		//
+		std::vector<uint32_t> semi( count ), label( count ), ancestor( count, invalid_node ), dom( count, invalid_node );
+		std::vector<std::vector<uint32_t>> bucket( count );
+		for ( uint32_t i = 0; i != count; i++ )
+			semi[ i ] = label[ i ] = i;
+
+		std::vector<uint32_t> path;
+		auto eval = [ & ] ( uint32_t v )
+		{
+			if ( ancestor[ v ] == invalid_node )
+				return v;
+
+			// Collect the path up to the root of the forest and compress it.
+			//
+			path.clear();
+			for ( uint32_t u = v; ancestor[ ancestor[ u ] ] != invalid_node; u = ancestor[ u ] )
+				path.push_back( u );
+			for ( size_t k = path.size(); k--; )
+			{
+				uint32_t u = path[ k ];
+				uint32_t a = ancestor[ u ];
+				if ( semi[ label[ a ] ] < semi[ label[ u ] ] )
+					label[ u ] = label[ a ];
+				ancestor[ u ] = ancestor[ a ];
+			}
+			return label[ v ];
+		};
+
+		for ( uint32_t w = count - 1; w > 0; w-- )
+		{
+			predecessors( vertex[ w ], [ & ] ( uint32_t p )
+			{
+				if ( number[ p ] == invalid_node )
+					return;
+				uint32_t u = eval( number[ p ] );
+				if ( semi[ u ] < semi[ w ] )
+					semi[ w ] = semi[ u ];
+			} );
+			bucket[ semi[ w ] ].push_back( w );
+			ancestor[ w ] = parent[ w ];
+
+			for ( uint32_t v : bucket[ parent[ w ] ] )
+			{
+				uint32_t u = eval( v );
+				dom[ v ] = semi[ u ] < semi[ v ] ? u : parent[ w ];
+			}
+			bucket[ parent[ w ] ].clear();
+		}
+		for ( uint32_t w = 1; w < count; w++ )
+			if ( dom[ w ] != semi[ w ] )
+				dom[ w ] = dom[ dom[ w ] ];
+
+		// Translate the immediate dominators back into the node space.
+		//
+		idom.assign( node_count, invalid_node );
+		for ( uint32_t w = 1; w < count; w++ )
+			idom[ vertex[ w ] ] = vertex[ dom[ w ] ];
+
+		// Number the nodes of the tree in pre-order and post-order.
+		//
+		std::vector<uint32_t> child_offsets( count + 1, 0 ), children( count );
+		for ( uint32_t w = 1; w < count; w++ )
+			child_offsets[ dom[ w ] + 1 ]++;
+		for ( uint32_t w = 0; w != count; w++ )
+			child_offsets[ w + 1 ] += child_offsets[ w ];
+		{
+			std::vector<uint32_t> cursor( child_offsets.begin(), child_offsets.end() - 1 );
+			for ( uint32_t w = 1; w < count; w++ )
+				children[ cursor[ dom[ w ] ]++ ] = w;
+		}
+
+		preorder.assign( node_count, invalid_node );
+		postorder.assign( node_count, invalid_node );
+		uint32_t pre_counter = 0, post_counter = 0;
+		std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, child_offsets[ 0 ] } };
+		preorder[ vertex[ 0 ] ] = pre_counter++;
+		while ( !stack.empty() )
+		{
+			auto& [w, next_child] = stack.back();
+			if ( next_child == child_offsets[ w + 1 ] )
+			{
+				postorder[ vertex[ w ] ] = post_counter++;
+				stack.pop_back();
+				continue;
+			}
+			uint32_t c = children[ next_child++ ];
+			preorder[ vertex[ c ] ] = pre_counter++;
+			stack.push_back( { c, child_offsets[ c ] } );
+		}
+	}
+
+	// Recomputes the trees if the control flow graph changed, must be called with the mutex held.
+	//
+	void dominance_analysis::update()
+	{
+		rtn->materialize_all();
+		uint64_t current_epoch = rtn->cfg_epoch.load();
+		if ( epoch == current_epoch )
+			return;
+		epoch = current_epoch;
+
+		// Map every block to its index.
+		//
+		size_t block_count = rtn->next_block_index;
+		blocks.assign( block_count, nullptr );
+		for ( auto& [vip, block] : rtn->explored_blocks )
+			blocks[ block->index ] = block;
+
+		// Compute the dominators starting from the entry point.
+		//
+		if ( rtn->entry_point )
+		{
+			dominators.build( block_count, rtn->entry_point->index,
+				[ & ] ( uint32_t n, auto&& fn ) { for ( basic_block* s : blocks[ n ]->next ) fn( s->index ); },
+				[ & ] ( uint32_t n, auto&& fn ) { for ( basic_block* p : blocks[ n ]->prev ) fn( p->index ); } 
+			);
+		}
+
+		// Compute the post-dominators over the reverse graph, starting from a virtual 
+		// exit node placed after every other block.
+		//
+		uint32_t exit_node = block_count;
+		post_dominators.build( block_count + 1, exit_node,
+			[ & ] ( uint32_t n, auto&& fn ) 
+			{ 
+				if ( n == exit_node )
+				{
+					for ( uint32_t i = 0; i != exit_node; i++ )
+						if ( blocks[ i ] && blocks[ i ]->next.empty() ) fn( i );
+				}
+				else
+				{
+					for ( basic_block* p : blocks[ n ]->prev ) fn( p->index );
+				}
+			},
+			[ & ] ( uint32_t n, auto&& fn ) 
+			{ 
+				if ( blocks[ n ]->next.empty() ) fn( exit_node );
+				for ( basic_block* s : blocks[ n ]->next ) fn( s->index );
+			}
+		);
+	}
+
+	// Returns whether or not a dominates b.
+	//
+	bool dominance_analysis::dominates( const basic_block* a, const basic_block* b )
+	{
+		std::lock_guard _g( mutex );
+		update();
+		return dominators.dominates( a->index, b->index );
+	}
+
+	// Returns whether or not a post-dominates b.
+	//
+	bool dominance_analysis::post_dominates( const basic_block* a, const basic_block* b )
+	{
+		std::lock_guard _g( mutex );
+		update();
+		return post_dominators.dominates( a->index, b->index );
+	}
+
+	// Returns the immediate dominator and post-dominator of the block, 
+	// returns nullptr if there is none.
+	//
+	basic_block* dominance_analysis::immediate_dominator( const basic_block* blk )
+	{
+		std::lock_guard _g( mutex );
+		update();
+		if ( blk->index >= dominators.idom.size() )
+			return nullptr;
+		uint32_t n = dominators.idom[ blk->index ];
+		return n != dominator_tree::invalid_node ? blocks[ n ] : nullptr;
+	}
+	basic_block* dominance_analysis::immediate_post_dominator( const basic_block* blk )
+	{
+		std::lock_guard _g( mutex );
+		update();
+		if ( blk->index >= post_dominators.idom.size() )
+			return nullptr;
+		uint32_t n = post_dominators.idom[ blk->index ];
+		return n < blocks.size() ? blocks[ n ] : nullptr;
+	}
+};
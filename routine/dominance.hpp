@@ -0,0 +1,125 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+namespace vtil
+{
+	// Forward declarations.
+	//
+	struct basic_block;
+	struct routine;
+
+	// Dominator tree over the blocks of a routine, indexed by the block index.
+	//
+	struct dominator_tree
+	{
+		static constexpr uint32_t invalid_node = ~0u;
+
+		// Immediate dominator of each node, invalid for the root and the 
+		// nodes that are not reachable from it.
+		//
+		std::vector<uint32_t> idom;
+
+		// Pre-order and post-order numbers of each node in the tree, 
+		// invalid for the nodes that are not reachable from the root.
+		//
+		std::vector<uint32_t> preorder;
+		std::vector<uint32_t> postorder;
+
+		// Returns whether or not the node is in the tree.
+		//
+		bool contains( size_t n ) const { return n < preorder.size() && preorder[ n ] != invalid_node; }
+
+		// Returns whether or not a dominates b, every node dominates itself.
+		//
+		bool dominates( size_t a, size_t b ) const
+		{
+			return contains( a ) && contains( b ) && 
+				   preorder[ a ] <= preorder[ b ] && postorder[ b ] <= postorder[ a ];
+		}
+
+		// Builds the tree using the Lengauer-Tarjan algorithm for the graph of the given size, given 
+		// the root and callbacks enumerating the successors and the predecessors of a node.
+		//
+		template<typename successor_enumerator, typename predecessor_enumerator>
+		void build( size_t node_count, uint32_t root, successor_enumerator&& successors, predecessor_enumerator&& predecessors );
+	};
+
+	// Dominance analysis of a routine, computed lazily on the first query and recomputed
+	// after the control flow graph changes, which is tracked by routine::cfg_epoch.
+	// - Post-dominators are computed over the reverse graph with a virtual exit node
+	//   succeeding every block that has no successors, blocks that cannot reach an 
+	//   exit are not post-dominated by any other block.
+	//
+	struct dominance_analysis
+	{
+		// Routine this analysis belongs to.
+		//
+		routine* rtn;
+
+		// Mutex guarding the analysis and the epoch it was computed at.
+		//
+		std::mutex mutex;
+		uint64_t epoch = ~0ull;
+
+		// Blocks indexed by the block index, and the trees.
+		//
+		std::vector<basic_block*> blocks;
+		dominator_tree dominators;
+		dominator_tree post_dominators;
+
+		// Construction.
+		//
+		dominance_analysis( routine* rtn ) : rtn( rtn ) {}
+
+		// Returns whether or not a dominates b, which is every path from the entry point 
+		// to b going through a. Every block dominates itself.
+		//
+		bool dominates( const basic_block* a, const basic_block* b );
+
+		// Returns whether or not a post-dominates b, which is every path from b
+		// to an exit going through a. Every block post-dominates itself.
+		//
+		bool post_dominates( const basic_block* a, const basic_block* b );
+
+		// Returns the immediate dominator and post-dominator of the block, 
+		// returns nullptr if there is none.
+		//
+		basic_block* immediate_dominator( const basic_block* blk );
+		basic_block* immediate_post_dominator( const basic_block* blk );
+
+	private:
+		// Recomputes the trees if the control flow graph changed, must be called with the mutex held.
+		//
+		void update();
+	};
+};
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "explorer.hpp"
+#include <algorithm>
+
+namespace vtil
+{
+	// State shared by all tasks of a single exploration.
+	//
+	struct explorer_state
+	{
+		const std::function<void( basic_block* )>& lifter;
+		thread_pool& pool;
+
+		// Blocks that were already scheduled.
+		//
+		block_table claimed;
+
+		// Number of blocks scheduled but not yet processed.
+		//
+		std::atomic<size_t> pending_count = 0;
+
+		// Flag signaling the completion to the caller, set under the mutex.
+		//
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool done = false;
+
+		explorer_state( routine* rtn, const std::function<void( basic_block* )>& lifter, thread_pool& pool )
+			: lifter( lifter ), pool( pool ), claimed( &rtn->allocator ) {}
+
+		// Schedules the block if it was not scheduled before.
+		//
+		void schedule( basic_block* blk )
+		{
+			if ( !claimed.insert( blk->entry_vip, blk ).second )
+				return;
+			pending_count++;
+			pool.push( [ this, blk ] () { process( blk ); } );
+		}
+
+		// Lifts the block and schedules each destination.
+		//
+		void process( basic_block* blk )
+		{
+			if ( !blk->is_complete() )
+				lifter( blk );
+			for ( basic_block* dst : blk->successors() )
+				schedule( dst );
+
+			// If this was the last block pending, signal the caller.
+			//
+			if ( --pending_count == 0 )
+			{
+				std::lock_guard _g( mutex );
+				done = true;
+				cv.notify_all();
+			}
+		}
+	};
+
+	// Explores the routine the block belongs to starting from the block, invoking the lifter on 
+	// the thread pool for each block reachable from it as they are discovered.
+	//
+	void explore( basic_block* entry, const std::function<void( basic_block* )>& lifter, thread_pool& pool )
+	{
+		routine* rtn = entry->owner;
+
+		// Schedule the entry block and wait until there are no pending blocks.
+		//
+		{
+			explorer_state state{ rtn, lifter, pool };
+			state.schedule( entry );
+
+			std::unique_lock lock( state.mutex );
+			state.cv.wait( lock, [ & ] { return state.done; } );
+		}
+
+		// Sort the .prev lists so that the result does not depend on the order 
+		// the blocks were processed in.
+		//
+		for ( auto& [vip, block] : rtn->explored_blocks )
+		{
+			std::sort( block->prev.begin(), block->prev.end(), [ ] ( basic_block* a, basic_block* b )
+			{
+				return a->entry_vip < b->entry_vip;
+			} );
+		}
+	}
+	void explore( basic_block* entry, const std::function<size_t( basic_block* )>& lifter, lift_cache& cache, thread_pool& pool )
+	{
+		explore( entry, [ & ] ( basic_block* blk )
+		{
+			if ( !cache.load( blk ) )
+				cache.store( blk, lifter( blk ) );
+		}, pool );
+	}
+};
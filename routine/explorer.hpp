@@ -25,40 +25,28 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
 // POSSIBILITY OF SUCH DAMAGE.        
 //
-#include "instruction_desc.hpp"
+#pragma once
+#include <functional>
+#include "basic_block.hpp"
+#include "lift_cache.hpp"
+#include "..\misc\thread_pool.hpp"
 
 namespace vtil
 {
-	// Generic data-assignment constructor with certain validity checks.
+	// Explores the routine the block belongs to starting from the block, invoking the lifter on 
+	// the thread pool for each block reachable from it as they are discovered.
+	// - Lifter is expected to fill the block and ->fork(...) it for each of its destinations, it
+	//   is invoked exactly once for each block that is not already complete.
+	// - Lifter may only modify the block passed to it, see basic_block.hpp for more information.
+	// - Regardless of the scheduling, the explored blocks and their edges will be the same, the 
+	//   .prev lists which are filled in the order blocks are forked are sorted by entry VIP.
+	// - Must not be invoked from a worker of the same pool.
 	//
-	instruction_desc::instruction_desc( const std::string& name, 
-										const std::vector<operand_access>& access_types, 
-										int access_size_index, 
-										bool is_volatile, 
-										math::operator_id symbolic_operator,
-										std::vector<int> branch_operands, 
-										const std::pair<int, bool>& memory_operands ) :
-		name( name ), access_types( access_types ), access_size_index( access_size_index - 1 ),
-		is_volatile( is_volatile ), symbolic_operator( symbolic_operator ),
-		memory_operand_index( memory_operands.first - 1 ), memory_write( memory_operands.second )
-	{
-		fassert( operand_count() <= max_operand_count );
+	void explore( basic_block* entry, const std::function<void( basic_block* )>& lifter, thread_pool& pool = thread_pool::get_default() );
 
-		// Validate all operand indices.
-		//
-		fassert( access_size_index == 0 || abs( access_size_index ) <= operand_count() );
-		fassert( memory_operands.first == 0 || abs( memory_operands.first ) <= operand_count() );
-		for ( int op : branch_operands )
-			fassert( op != 0 && abs( op ) <= operand_count() );
-
-		// Process branch operands.
-		//
-		for ( int op : branch_operands )
-		{
-			if ( op > 0 )
-				branch_operands_vip.push_back( op - 1 );
-			else
-				branch_operands_rip.push_back( -op - 1 );
-		}
-	}
-};
\ No newline at end of file
+	// Explores the routine as above, filling the blocks from the lift cache if they are cached and 
+	// storing the ones lifted into it otherwise.
+	// - Lifter returns the number of source bytes it consumed to lift the block, see lift_cache.hpp.
+	//
+	void explore( basic_block* entry, const std::function<size_t( basic_block* )>& lifter, lift_cache& cache, thread_pool& pool = thread_pool::get_default() );
+};
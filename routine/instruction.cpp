@@ -110,7 +110,7 @@ namespace vtil
 	int instruction::reads_from( const register_desc& rw ) const
 	{
 		for ( int i = 0; i < base->access_types.size(); i++ )
-			if ( base->access_types[ i ] != operand_access::write && operands[ i ].reg.overlaps( rw ) )
+			if ( base->access_types[ i ] != operand_access::write && operands[ i ].is_register() && operands[ i ].reg.overlaps( rw ) )
 				return i + 1;
 		return 0;
 	}
@@ -120,7 +120,7 @@ namespace vtil
 	int instruction::writes_to( const register_desc& rw ) const
 	{
 		for ( int i = 0; i < base->access_types.size(); i++ )
-			if ( base->access_types[ i ] >= operand_access::write && operands[ i ].reg.overlaps( rw ) )
+			if ( base->access_types[ i ] >= operand_access::write && operands[ i ].is_register() && operands[ i ].reg.overlaps( rw ) )
 				return i + 1;
 		return 0;
 	}
@@ -130,7 +130,7 @@ namespace vtil
 	int instruction::overwrites( const register_desc& rw ) const
 	{
 		for ( int i = 0; i < base->access_types.size(); i++ )
-			if ( base->access_types[ i ] == operand_access::write && operands[ i ].reg.overlaps( rw ) )
+			if ( base->access_types[ i ] == operand_access::write && operands[ i ].is_register() && operands[ i ].reg.overlaps( rw ) )
 				return i + 1;
 		return 0;
 	}
@@ -28,7 +28,9 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <type_traits>
 #include "..\arch\instruction_set.hpp"
+#include "..\misc\fixed_vector.hpp"
 
 namespace vtil
 {
@@ -51,9 +53,9 @@ namespace vtil
 		//
 		const instruction_desc* base = nullptr;
 
-		// List of operands.
+		// List of operands, stored inline.
 		//
-		std::vector<operand> operands;
+		fixed_vector<operand, max_operand_count> operands;
 
 		// Virtual instruction pointer that this instruction
 		// originally was generated based on.
@@ -77,7 +79,7 @@ namespace vtil
 		//
 		instruction() = default;
 		instruction( const instruction_desc* base,
-					 const std::vector<operand>& operands = {},
+					 const fixed_vector<operand, max_operand_count>& operands = {},
 					 vip_t vip = invalid_vip,
 					 bool explicit_volatile = false ) :
 			base( base ), operands( operands ),
@@ -133,4 +135,8 @@ namespace vtil
 		//
 		std::string to_string() const;
 	};
+
+	// Instructions hold no references to any other memory and thus can be freely relocated.
+	//
+	static_assert( std::is_trivially_copyable_v<instruction>, "Instruction must be trivially copyable." );
 };
@@ -0,0 +1,663 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <new>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <initializer_list>
+#include <memory_resource>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include "instruction.hpp"
+
+namespace vtil
+{
+	// Shift of the stack pointer offset and the stack instance index.
+	//
+	struct sp_shift
+	{
+		int64_t offset = 0;
+		int64_t index = 0;
+
+		sp_shift& operator+=( const sp_shift& o ) { offset += o.offset; index += o.index; return *this; }
+		sp_shift operator-() const { return { -offset, -index }; }
+		bool is_zero() const { return !offset && !index; }
+
+		// Applies the shift to the instruction, moving the displacement of the stack pointer 
+		// relative memory operands along with the stack pointer offset.
+		//
+		void apply( instruction& ins ) const
+		{
+			ins.sp_offset += offset;
+			ins.sp_index = uint32_t( ins.sp_index + index );
+			if ( offset && ins.base && ins.base->accesses_memory() &&
+				 ins.operands[ ins.base->memory_operand_index ].reg.is_stack_pointer() )
+				ins.operands[ ins.base->memory_operand_index + 1 ].imm.i64 += offset;
+		}
+	};
+
+	// Container used to store the instructions of a basic block. It is a doubly
+	// linked list so that iterators and references stay valid across insertions and
+	// erasures, however the nodes are allocated from segments owned by the stream 
+	// itself rather than individually from the heap, so that instructions appended in 
+	// sequence are laid out contiguously and a linear scan walks memory in order.
+	// - Erased nodes are recycled by later insertions.
+	// - Segments are allocated from the memory resource the stream is bound to,
+	//   which is the arena of the owning routine for streams of basic blocks.
+	// - Every node carries an ordinal which increases along the list, so that the 
+	//   order of two positions can be compared without walking the list.
+	// - Stack pointer shifts of a range of instructions are queued rather than applied, see 
+	//   shift. While any is pending the stack pointer details and the displacement of the 
+	//   stack pointer relative memory operands stored in the instructions are out of date, 
+	//   resolve returns an instruction with them applied and normalize applies them all.
+	//
+	struct instruction_stream
+	{
+		// Links of a node, separated from the node itself so that the sentinel 
+		// does not have to hold an instruction.
+		//
+		struct node_links
+		{
+			node_links* prev = nullptr;
+			node_links* next = nullptr;
+		};
+		struct node : node_links
+		{
+			uint64_t ordinal;
+			sp_shift marker;
+			instruction value;
+		};
+
+		// Index of the pending stack pointer shifts. Each shift of a range is recorded as a marker 
+		// on its first node and a cancelling one on the node following it, and the sum of the 
+		// markers up to a node, which is the shift pending on it, is kept in a Fenwick tree keyed 
+		// by ordinal, so that both queueing and resolving a shift are logarithmic.
+		// - Instructions resetting the stack pointer are indexed as well to find the end of 
+		//   the stack instance a position belongs to.
+		//
+		struct shift_index
+		{
+			std::unordered_map<uint64_t, sp_shift> sums;
+			std::map<uint64_t, node_links*> resets;
+
+			void add( uint64_t ordinal, const sp_shift& delta )
+			{
+				for ( uint64_t i = ordinal; i; i += i & ( ~i + 1 ) )
+					sums[ i ] += delta;
+			}
+			sp_shift prefix( uint64_t ordinal ) const
+			{
+				sp_shift sum;
+				for ( uint64_t i = ordinal; i; i &= i - 1 )
+				{
+					auto it = sums.find( i );
+					if ( it != sums.end() )
+						sum += it->second;
+				}
+				return sum;
+			}
+		};
+
+		// Distance between the ordinals of the instructions appended in sequence, leaving space
+		// for the ones inserted in between later on before the ordinals have to be relabeled.
+		//
+		static constexpr uint64_t ordinal_spacing = 1ull << 20;
+
+		// Growth of the number of nodes a range of ordinals may hold per doubling of its size for 
+		// it to be relabeled, see relabel. Must be above 1 and below 2, the larger it is the sparser 
+		// the ranges relabeled are and thus the less frequently they have to be relabeled again.
+		//
+		static constexpr double relabel_growth = 4.0 / 3.0;
+
+		// Segments are allocated with geometrically growing sizes up to the maximum.
+		//
+		static constexpr size_t min_segment_size = 16;
+		static constexpr size_t max_segment_size = 1024;
+		struct segment
+		{
+			segment* next;
+			size_t capacity;
+			size_t used;
+			node* nodes() { return ( node* ) ( this + 1 ); }
+		};
+		static_assert( sizeof( segment ) % alignof( node ) == 0 && alignof( node ) <= alignof( segment ), "Segment header misaligns the nodes." );
+
+		// Bidirectional iterator over the stream.
+		//
+		template<typename value_type_, typename links_type>
+		struct basic_iterator
+		{
+			using iterator_category = std::bidirectional_iterator_tag;
+			using value_type = std::remove_const_t<value_type_>;
+			using difference_type = ptrdiff_t;
+			using pointer = value_type_*;
+			using reference = value_type_&;
+
+			// Node pointed at.
+			//
+			links_type* at = nullptr;
+
+			// Default constructor, construction from node and the implicit conversion to constant iterator.
+			//
+			basic_iterator() {}
+			basic_iterator( links_type* at ) : at( at ) {}
+			template<typename X, typename Y, std::enable_if_t<std::is_convertible_v<Y*, links_type*>, int> = 0>
+			basic_iterator( const basic_iterator<X, Y>& o ) : at( o.at ) {}
+
+			// Iteration.
+			//
+			basic_iterator& operator++() { at = at->next; return *this; }
+			basic_iterator& operator--() { at = at->prev; return *this; }
+			basic_iterator operator++( int ) { auto s = *this; at = at->next; return s; }
+			basic_iterator operator--( int ) { auto s = *this; at = at->prev; return s; }
+
+			// Dereferencing.
+			//
+			reference operator*() const { return static_cast<std::conditional_t<std::is_const_v<value_type_>, const node*, node*>>( at )->value; }
+			pointer operator->() const { return &operator*(); }
+
+			// Basic comparison operators.
+			//
+			bool operator==( const basic_iterator& o ) const { return at == o.at; }
+			bool operator!=( const basic_iterator& o ) const { return at != o.at; }
+		};
+		using value_type = instruction;
+		using size_type = size_t;
+		using difference_type = ptrdiff_t;
+		using reference = instruction&;
+		using const_reference = const instruction&;
+		using iterator = basic_iterator<instruction, node_links>;
+		using const_iterator = basic_iterator<const instruction, const node_links>;
+		using reverse_iterator = std::reverse_iterator<iterator>;
+		using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+		// Sentinel node marking both ends of the list.
+		//
+		node_links head;
+
+		// Number of instructions stored.
+		//
+		size_t length = 0;
+
+		// List of segments allocated and the list of recycled nodes.
+		//
+		segment* segments = nullptr;
+		node_links* free_list = nullptr;
+
+		// Memory resource the segments are allocated from.
+		//
+		std::pmr::memory_resource* resource;
+
+		// Counter incremented on every modification other than appending to the end,
+		// which invalidates any ordinal or node reference held by an index over the stream.
+		//
+		uint64_t edit_epoch = 0;
+
+		// Index of the pending stack pointer shifts, created on the first shift and released 
+		// on normalization, and the counter incremented on every shift.
+		//
+		std::unique_ptr<shift_index> shifts;
+		uint64_t shift_epoch = 0;
+
+		// Construction, copy and move.
+		//
+		instruction_stream( std::pmr::memory_resource* resource = std::pmr::get_default_resource() ) : resource( resource ) { head.prev = head.next = &head; }
+		instruction_stream( std::initializer_list<instruction> list ) : instruction_stream() { for ( auto& ins : list ) push_back( ins ); }
+		instruction_stream( const instruction_stream& o ) : instruction_stream() { o.enumerate_resolved( [ & ] ( const instruction& ins ) { push_back( ins ); } ); }
+		instruction_stream( instruction_stream&& o ) noexcept : instruction_stream() { swap( o ); }
+		instruction_stream& operator=( const instruction_stream& o )
+		{
+			if ( this != &o )
+			{
+				clear();
+				o.enumerate_resolved( [ & ] ( const instruction& ins ) { push_back( ins ); } );
+			}
+			return *this;
+		}
+		instruction_stream& operator=( instruction_stream&& o ) noexcept { swap( o ); return *this; }
+		~instruction_stream() { clear(); }
+
+		// Swaps the contents of two streams, fixing up the links to the sentinels.
+		//
+		void swap( instruction_stream& o )
+		{
+			std::swap( head, o.head );
+			std::swap( length, o.length );
+			std::swap( segments, o.segments );
+			std::swap( free_list, o.free_list );
+			std::swap( resource, o.resource );
+			std::swap( shifts, o.shifts );
+			edit_epoch++;
+			o.edit_epoch++;
+			shift_epoch++;
+			o.shift_epoch++;
+			for ( instruction_stream* s : { this, &o } )
+			{
+				if ( s->length )
+					s->head.next->prev = s->head.prev->next = &s->head;
+				else
+					s->head.prev = s->head.next = &s->head;
+			}
+		}
+
+		// Basic container properties.
+		//
+		size_t size() const { return length; }
+		bool empty() const { return length == 0; }
+
+		// Iterators.
+		//
+		iterator begin() { return { head.next }; }
+		iterator end() { return { &head }; }
+		const_iterator begin() const { return { head.next }; }
+		const_iterator end() const { return { &head }; }
+		const_iterator cbegin() const { return begin(); }
+		const_iterator cend() const { return end(); }
+		reverse_iterator rbegin() { return reverse_iterator{ end() }; }
+		reverse_iterator rend() { return reverse_iterator{ begin() }; }
+		const_reverse_iterator rbegin() const { return const_reverse_iterator{ end() }; }
+		const_reverse_iterator rend() const { return const_reverse_iterator{ begin() }; }
+
+		// Element access.
+		//
+		instruction& front() { return *begin(); }
+		instruction& back() { return *std::prev( end() ); }
+		const instruction& front() const { return *begin(); }
+		const instruction& back() const { return *std::prev( end() ); }
+
+		// Returns the ordinal of the position, the end of the stream compares greater than any instruction.
+		//
+		uint64_t ordinal( const_iterator pos ) const { return pos.at == &head ? ~0ull : static_cast< const node* >( pos.at )->ordinal; }
+
+		// Inserts an instruction before the given position, returns the iterator to it.
+		//
+		iterator insert( const_iterator pos, const instruction& ins )
+		{
+			node_links* next = const_cast< node_links* >( pos.at );
+			node_links* prev = next->prev;
+
+			// Pick an ordinal between the neighbours, relabel the ordinals around them if there is no space left.
+			//
+			if ( next != &head )
+			{
+				edit_epoch++;
+				if ( ordinal( next ) - ( prev == &head ? 0 : ordinal( prev ) ) < 2 )
+					relabel( prev == &head ? next : prev );
+			}
+			uint64_t lower = prev == &head ? 0 : ordinal( prev );
+			uint64_t n_ordinal = next == &head ? lower + ordinal_spacing : lower + ( ordinal( next ) - lower ) / 2;
+
+			node* n = new ( allocate_node() ) node{ { prev, next }, n_ordinal, {}, ins };
+			prev->next = n;
+			next->prev = n;
+			length++;
+
+			// If there are pending shifts, store the instruction relative to the shift pending 
+			// at the position so that it resolves back to the values given.
+			//
+			if ( shifts )
+			{
+				if ( prev != &head )
+					( -shifts->prefix( ordinal( prev ) ) ).apply( n->value );
+				if ( n->value.sp_reset )
+					shifts->resets.emplace( n_ordinal, n );
+			}
+			return { n };
+		}
+		template<typename... Tx>
+		iterator emplace( const_iterator pos, Tx&&... args ) { return insert( pos, instruction( std::forward<Tx>( args )... ) ); }
+
+		// Erases the instruction at the given position, returns the iterator to the following one.
+		//
+		iterator erase( const_iterator pos )
+		{
+			node_links* at = const_cast< node_links* >( pos.at );
+			fassert( at != &head );
+			node_links* next = at->next;
+
+			// Move the marker of the node to the following one, which leaves the shifts pending 
+			// on the rest of the stream as is, and drop it from the index.
+			//
+			if ( shifts )
+			{
+				node* n = static_cast< node* >( at );
+				if ( !n->marker.is_zero() )
+				{
+					shifts->add( n->ordinal, -n->marker );
+					if ( next != &head )
+					{
+						static_cast< node* >( next )->marker += n->marker;
+						shifts->add( ordinal( next ), n->marker );
+					}
+				}
+				if ( n->value.sp_reset )
+					shifts->resets.erase( n->ordinal );
+			}
+
+			at->prev->next = next;
+			next->prev = at->prev;
+			static_cast< node* >( at )->~node();
+			free_list = new ( at ) node_links{ nullptr, free_list };
+			length--;
+			edit_epoch++;
+			return { next };
+		}
+		iterator erase( const_iterator first, const_iterator last )
+		{
+			while ( first != last )
+				first = erase( first );
+			return { const_cast< node_links* >( last.at ) };
+		}
+
+		// Wrappers around insertion and erasure at the ends.
+		//
+		void push_back( const instruction& ins ) { insert( end(), ins ); }
+		void push_front( const instruction& ins ) { insert( begin(), ins ); }
+		template<typename... Tx>
+		instruction& emplace_back( Tx&&... args ) { return *emplace( end(), std::forward<Tx>( args )... ); }
+		void pop_back() { erase( std::prev( end() ) ); }
+		void pop_front() { erase( begin() ); }
+
+		// Erases every instruction and releases all segments.
+		//
+		void clear()
+		{
+			if constexpr ( !std::is_trivially_destructible_v<node> )
+			{
+				for ( node_links* it = head.next; it != &head; )
+				{
+					node_links* next = it->next;
+					static_cast< node* >( it )->~node();
+					it = next;
+				}
+			}
+			while ( segments )
+			{
+				segment* next = segments->next;
+				resource->deallocate( segments, sizeof( segment ) + segments->capacity * sizeof( node ), alignof( segment ) );
+				segments = next;
+			}
+			free_list = nullptr;
+			head.prev = head.next = &head;
+			length = 0;
+			shifts.reset();
+			edit_epoch++;
+		}
+
+		// Queues a shift of the stack pointer for the instructions in the range.
+		//
+		void shift( const_iterator first, const_iterator last, const sp_shift& delta )
+		{
+			shift_epoch++;
+			if ( first == last || delta.is_zero() )
+				return;
+
+			index_shifts();
+			node* n = static_cast< node* >( const_cast< node_links* >( first.at ) );
+			n->marker += delta;
+			shifts->add( n->ordinal, delta );
+			if ( last.at != &head )
+			{
+				n = static_cast< node* >( const_cast< node_links* >( last.at ) );
+				n->marker += -delta;
+				shifts->add( n->ordinal, -delta );
+			}
+		}
+
+		// Returns the shift pending on the instruction at the position.
+		//
+		sp_shift pending_shift( const_iterator pos ) const
+		{
+			if ( !shifts || pos.at == &head )
+				return {};
+			return shifts->prefix( ordinal( pos ) );
+		}
+
+		// Returns a copy of the instruction at the position with the pending shift applied.
+		//
+		instruction resolve( const_iterator pos ) const
+		{
+			instruction ins = *pos;
+			if ( shifts )
+				pending_shift( pos ).apply( ins );
+			return ins;
+		}
+
+		// Invokes the enumerator with each instruction, resolving the pending shifts.
+		//
+		template<typename T>
+		void enumerate_resolved( T&& enumerator ) const
+		{
+			sp_shift sum;
+			for ( node_links* it = head.next; it != &head; it = it->next )
+			{
+				const node* n = static_cast< const node* >( it );
+				sum += n->marker;
+				if ( sum.is_zero() )
+				{
+					enumerator( n->value );
+				}
+				else
+				{
+					instruction ins = n->value;
+					sum.apply( ins );
+					enumerator( ins );
+				}
+			}
+		}
+
+		// Returns the first instruction at or after the position resetting the stack 
+		// pointer, or the end of the stream if there is none.
+		//
+		iterator next_reset( const_iterator pos )
+		{
+			if ( pos.at == &head )
+				return end();
+			index_shifts();
+			auto it = shifts->resets.lower_bound( ordinal( pos ) );
+			return { it == shifts->resets.end() ? &head : it->second };
+		}
+
+		// Sets or clears the stack pointer reset flag of the instruction at the position, 
+		// the flag should not be changed otherwise while there are pending shifts.
+		//
+		void set_reset( iterator pos, bool reset )
+		{
+			if ( pos->sp_reset == reset )
+				return;
+			pos->sp_reset = reset;
+			if ( shifts )
+			{
+				if ( reset ) shifts->resets.emplace( ordinal( pos ), pos.at );
+				else         shifts->resets.erase( ordinal( pos ) );
+			}
+		}
+
+		// Applies every pending shift to the instructions, readers that cannot modify 
+		// the stream should resolve them instead, see resolve and enumerate_resolved.
+		//
+		void normalize()
+		{
+			if ( !shifts )
+				return;
+			sp_shift sum;
+			for ( node_links* it = head.next; it != &head; it = it->next )
+			{
+				node* n = static_cast< node* >( it );
+				sum += n->marker;
+				n->marker = {};
+				sum.apply( n->value );
+			}
+			shifts.reset();
+		}
+
+		// Basic comparison operators.
+		//
+		bool operator==( const instruction_stream& o ) const 
+		{ 
+			if ( length != o.length )
+				return false;
+
+			// Compare the instructions with the pending shifts of both streams resolved.
+			//
+			const node_links* it = o.head.next;
+			sp_shift sum;
+			bool equal = true;
+			enumerate_resolved( [ & ] ( const instruction& ins )
+			{
+				const node* n = static_cast< const node* >( it );
+				it = it->next;
+				sum += n->marker;
+				if ( !equal )
+					return;
+				if ( sum.is_zero() )
+				{
+					equal = ins == n->value;
+				}
+				else
+				{
+					instruction other = n->value;
+					sum.apply( other );
+					equal = ins == other;
+				}
+			} );
+			return equal;
+		}
+		bool operator!=( const instruction_stream& o ) const { return !operator==( o ); }
+
+	private:
+		// Makes room for an ordinal next to the node by spreading the ordinals of the smallest range
+		// around it that is sparse enough, as in the order maintenance scheme of Bender et al. Ranges
+		// are aligned to their size and a range of 2^i ordinals qualifies if it would hold at most 
+		// relabel_growth^i nodes after the insertion, which leaves a gap of at least (2/growth)^i 
+		// between the nodes relabeled and keeps the amortized cost of an insertion logarithmic.
+		//
+		void relabel( node_links* at )
+		{
+			uint64_t origin = ordinal( at );
+			node_links* first = at;
+			node_links* last = at;
+			size_t count = 1;
+			double limit = 1;
+			for ( uint32_t level = 1; ; level++ )
+			{
+				// Extend the range of nodes to every one within the aligned range of ordinals.
+				//
+				uint64_t span = 1ull << level;
+				uint64_t base = origin & ~( span - 1 );
+				while ( first->prev != &head && ordinal( first->prev ) >= base )
+					first = first->prev, count++;
+				while ( last->next != &head && ordinal( last->next ) - base < span )
+					last = last->next, count++;
+
+				limit *= relabel_growth;
+				if ( double( count + 1 ) > limit && level != 63 )
+					continue;
+
+				// Drop the range from the index of the pending shifts, spread the ordinals evenly and 
+				// add it back under the new ordinals.
+				//
+				node_links* end = last->next;
+				if ( shifts )
+				{
+					for ( node_links* it = first; it != end; it = it->next )
+					{
+						node* n = static_cast< node* >( it );
+						if ( !n->marker.is_zero() )
+							shifts->add( n->ordinal, -n->marker );
+						if ( n->value.sp_reset )
+							shifts->resets.erase( n->ordinal );
+					}
+				}
+				uint64_t step = span / ( count + 1 );
+				uint64_t n_ordinal = base;
+				for ( node_links* it = first; it != end; it = it->next )
+					static_cast< node* >( it )->ordinal = ( n_ordinal += step );
+				if ( shifts )
+				{
+					for ( node_links* it = first; it != end; it = it->next )
+					{
+						node* n = static_cast< node* >( it );
+						if ( !n->marker.is_zero() )
+							shifts->add( n->ordinal, n->marker );
+						if ( n->value.sp_reset )
+							shifts->resets.emplace( n->ordinal, n );
+					}
+				}
+				return;
+			}
+		}
+
+		// Creates the index of the pending shifts if it does not exist.
+		//
+		void index_shifts()
+		{
+			if ( shifts )
+				return;
+			shifts = std::make_unique<shift_index>();
+			for ( node_links* it = head.next; it != &head; it = it->next )
+			{
+				node* n = static_cast< node* >( it );
+				if ( !n->marker.is_zero() )
+					shifts->add( n->ordinal, n->marker );
+				if ( n->value.sp_reset )
+					shifts->resets.emplace( n->ordinal, n );
+			}
+		}
+
+		// Allocates storage for a node, preferring the recycled ones.
+		//
+		void* allocate_node()
+		{
+			// Pop from the free list if not empty.
+			//
+			if ( free_list )
+			{
+				node_links* n = free_list;
+				free_list = n->next;
+				return n;
+			}
+
+			// Allocate a new segment if the current one is full.
+			//
+			if ( !segments || segments->used == segments->capacity )
+			{
+				size_t capacity = segments ? std::min( segments->capacity * 2, max_segment_size ) : min_segment_size;
+				segment* seg = ( segment* ) resource->allocate( sizeof( segment ) + capacity * sizeof( node ), alignof( segment ) );
+				seg->next = segments;
+				seg->capacity = capacity;
+				seg->used = 0;
+				segments = seg;
+			}
+			return &segments->nodes()[ segments->used++ ];
+		}
+	};
+};
@@ -0,0 +1,283 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "lift_cache.hpp"
+#include "serialization.hpp"
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+namespace vtil
+{
+	static constexpr uint32_t lift_cache_magic = 'LCTV';
+
+	// Creates the cache reading the file at the given path if it exists, the file is 
+	// ignored if it is not a valid cache file.
+	//
+	lift_cache::lift_cache( std::string path, size_t capacity, fingerprint_function fingerprint )
+		: path( std::move( path ) ), capacity( capacity ), fingerprint( std::move( fingerprint ) )
+	{
+		std::ifstream file( this->path, std::ios::binary );
+		if ( !file )
+			return;
+		std::vector<uint8_t> raw{ std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() };
+
+		// Validate the header.
+		//
+		byte_reader in = { raw.data(), raw.size() };
+		uint32_t magic = in.read<uint32_t>();
+		uint32_t version = in.read<uint32_t>();
+		uint64_t count = in.read<uint64_t>();
+		if ( !in.is_valid() || magic != lift_cache_magic || version != serialization_version )
+			return;
+
+		// Read the entries, which are stored least recently used first, splitting the records 
+		// by their length prefix. Records themselves are validated when they are loaded.
+		//
+		std::lock_guard _g( mutex );
+		for ( uint64_t n = 0; n != count && in.is_valid(); n++ )
+		{
+			entry value;
+			value.entry_vip = in.read<vip_t>();
+			value.source_length = in.read<uint64_t>();
+			value.fingerprint = in.read<uint64_t>();
+			const uint8_t* record = in.cursor;
+			if ( !in.consume( in.read<uint32_t>() ) )
+				break;
+			value.record.assign( record, in.cursor );
+			insert_locked( std::move( value ) );
+		}
+		dirty = entries.size() != count;
+	}
+
+	// Writes the contents back on destruction.
+	//
+	lift_cache::~lift_cache()
+	{
+		flush();
+	}
+
+	// Erases the entry, must be called with the mutex held.
+	//
+	void lift_cache::erase_locked( std::list<entry>::iterator it )
+	{
+		auto [begin, end] = index.equal_range( it->entry_vip );
+		for ( auto i = begin; i != end; ++i )
+		{
+			if ( i->second == it )
+			{
+				index.erase( i );
+				break;
+			}
+		}
+		footprint -= it->footprint();
+		entries.erase( it );
+	}
+
+	// Inserts an entry as the most recently used one replacing the entry with the same key, 
+	// and evicts the least recently used ones that do not fit, must be called with the mutex held.
+	//
+	void lift_cache::insert_locked( entry&& value )
+	{
+		auto [begin, end] = index.equal_range( value.entry_vip );
+		for ( auto i = begin; i != end; ++i )
+		{
+			if ( i->second->source_length == value.source_length && i->second->fingerprint == value.fingerprint )
+			{
+				erase_locked( i->second );
+				break;
+			}
+		}
+		if ( value.footprint() > capacity )
+			return;
+
+		footprint += value.footprint();
+		vip_t vip = value.entry_vip;
+		entries.push_front( std::move( value ) );
+		index.emplace( vip, entries.begin() );
+		while ( footprint > capacity )
+			erase_locked( std::prev( entries.end() ) );
+	}
+
+	// Fills the block from the cache if a block lifted from the same source bytes is cached,
+	// forking each of its destinations, returns whether it was found.
+	//
+	bool lift_cache::load( basic_block* blk )
+	{
+		if ( !blk->stream.empty() )
+			return false;
+		vip_t vip = blk->entry_vip;
+
+		// Collect the source lengths of the entries for the VIP.
+		//
+		std::vector<uint64_t> lengths;
+		{
+			std::lock_guard _g( mutex );
+			auto [begin, end] = index.equal_range( vip );
+			for ( auto i = begin; i != end; ++i )
+				lengths.push_back( i->second->source_length );
+		}
+
+		// Hash the source bytes for each length, outside the lock, and try the entry matching.
+		//
+		for ( uint64_t length : lengths )
+		{
+			std::optional<uint64_t> hash = fingerprint( vip, length );
+			if ( !hash )
+				continue;
+
+			// Copy the record and mark the entry as the most recently used one.
+			//
+			std::vector<uint8_t> record;
+			{
+				std::lock_guard _g( mutex );
+				auto [begin, end] = index.equal_range( vip );
+				for ( auto i = begin; i != end; ++i )
+				{
+					if ( i->second->source_length == length && i->second->fingerprint == *hash )
+					{
+						entries.splice( entries.begin(), entries, i->second );
+						record = i->second->record;
+						dirty = true;
+						break;
+					}
+				}
+			}
+			if ( record.empty() )
+				continue;
+
+			// Decode the record and fork the destinations.
+			//
+			std::vector<vip_t> prev;
+			std::vector<vip_t> next;
+			byte_reader in = { record.data(), record.size() };
+			if ( deserialize( in, blk, prev, next ) && blk->entry_vip == vip && blk->is_complete() )
+			{
+				for ( vip_t dst : next )
+					blk->fork( dst );
+				return true;
+			}
+
+			// If the record is malformed, reset the block and drop the entry.
+			//
+			blk->entry_vip = vip;
+			blk->stream.clear();
+			blk->sp_offset = 0;
+			blk->sp_index = 0;
+			blk->last_temporary_index = 0;
+
+			std::lock_guard _g( mutex );
+			auto [begin, end] = index.equal_range( vip );
+			for ( auto i = begin; i != end; ++i )
+			{
+				if ( i->second->source_length == length && i->second->fingerprint == *hash )
+				{
+					erase_locked( i->second );
+					dirty = true;
+					break;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Stores the lifted block given the number of source bytes consumed by the lifter.
+	//
+	void lift_cache::store( basic_block* blk, size_t source_length )
+	{
+		if ( !source_length || !blk->is_complete() )
+			return;
+		std::optional<uint64_t> hash = fingerprint( blk->entry_vip, source_length );
+		if ( !hash )
+			return;
+
+		// Serialize the block in the compact encoding, holding the lock of .prev as 
+		// it may be extended concurrently by the blocks forking into this one.
+		//
+		serialization_options options;
+		options.compact = true;
+		byte_writer out;
+		blk->lock_prev();
+		serialize( out, blk, options );
+		blk->unlock_prev();
+
+		std::lock_guard _g( mutex );
+		insert_locked( { blk->entry_vip, source_length, *hash, std::move( out.buffer ) } );
+		dirty = true;
+	}
+
+	// Writes the contents to the file if they changed, returns whether it succeeded.
+	//
+	bool lift_cache::flush()
+	{
+		std::lock_guard _f( file_mutex );
+
+		// Write the header and the entries least recently used first, so that reading 
+		// them in order restores the order.
+		//
+		byte_writer out;
+		{
+			std::lock_guard _g( mutex );
+			if ( !dirty )
+				return true;
+			out.write<uint32_t>( lift_cache_magic );
+			out.write<uint32_t>( serialization_version );
+			out.write<uint64_t>( entries.size() );
+			for ( auto it = entries.rbegin(); it != entries.rend(); ++it )
+			{
+				out.write<vip_t>( it->entry_vip );
+				out.write<uint64_t>( it->source_length );
+				out.write<uint64_t>( it->fingerprint );
+				out.write_bytes( it->record.data(), it->record.size() );
+			}
+			dirty = false;
+		}
+
+		// Write into a temporary file and replace the file with it, so that the file is 
+		// never left partially written.
+		//
+		std::string temporary = path + ".tmp";
+		bool written;
+		{
+			std::ofstream file( temporary, std::ios::binary | std::ios::trunc );
+			written = file && file.write( ( const char* ) out.data(), out.size() );
+		}
+		std::error_code ec;
+		if ( written )
+			std::filesystem::rename( temporary, path, ec );
+
+		// If it failed, mark the contents as changed so that it is retried.
+		//
+		if ( !written || ec )
+		{
+			std::lock_guard _g( mutex );
+			dirty = true;
+			return false;
+		}
+		return true;
+	}
+};
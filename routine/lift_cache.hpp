@@ -0,0 +1,131 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include "basic_block.hpp"
+
+namespace vtil
+{
+	// Persistent cache of lifted blocks, so that lifting the same image again after a restart can 
+	// reuse the blocks lifted before instead of lifting them again.
+	// - Blocks are keyed by their entry VIP and the hash of the source bytes the lifter consumed,
+	//   which is computed by the fingerprint function the cache is created with. Since the number 
+	//   of bytes is only known after lifting, it is stored along with the hash and a block matches
+	//   if the source bytes of the same length at its entry VIP hash the same.
+	// - Bodies are stored as compact block records as serialized by serialization.hpp.
+	// - Size of the cache is bounded, evicting the least recently used blocks first, and the 
+	//   order is kept across restarts.
+	// - Contents are read from the file on construction and written back by ::flush(), which 
+	//   replaces the file at once, and on destruction.
+	// - Safe to use from multiple threads.
+	//
+	struct lift_cache
+	{
+		// Function returning the hash of the given number of source bytes at the VIP, 
+		// or nullopt if they cannot be read.
+		//
+		using fingerprint_function = std::function<std::optional<uint64_t>( vip_t vip, size_t length )>;
+
+		// Key and the block record of each entry.
+		//
+		struct entry
+		{
+			vip_t entry_vip;
+			uint64_t source_length;
+			uint64_t fingerprint;
+			std::vector<uint8_t> record;
+
+			// Returns the number of bytes the entry accounts for.
+			//
+			size_t footprint() const { return sizeof( entry ) + record.size(); }
+		};
+
+		// Path of the cache file, the limit of its size in bytes and the fingerprint function.
+		//
+		std::string path;
+		size_t capacity;
+		fingerprint_function fingerprint;
+
+		// Mutex guarding the state below and the one serializing the writes of the file.
+		//
+		mutable std::mutex mutex;
+		std::mutex file_mutex;
+
+		// List of entries, most recently used first, and the index of them by their entry VIP.
+		//
+		std::list<entry> entries;
+		std::unordered_multimap<vip_t, std::list<entry>::iterator> index;
+
+		// Number of bytes used and whether the contents changed since they were last written.
+		//
+		size_t footprint = 0;
+		bool dirty = false;
+
+		// Creates the cache reading the file at the given path if it exists, the file is 
+		// ignored if it is not a valid cache file.
+		//
+		lift_cache( std::string path, size_t capacity, fingerprint_function fingerprint );
+		lift_cache( const lift_cache& ) = delete;
+		lift_cache& operator=( const lift_cache& ) = delete;
+		~lift_cache();
+
+		// Fills the block from the cache if a block lifted from the same source bytes is cached,
+		// forking each of its destinations, returns whether it was found. Block must be empty.
+		//
+		bool load( basic_block* blk );
+
+		// Stores the lifted block given the number of source bytes consumed by the lifter, 
+		// blocks with no source bytes are not cached.
+		//
+		void store( basic_block* blk, size_t source_length );
+
+		// Writes the contents to the file if they changed, returns whether it succeeded.
+		//
+		bool flush();
+
+		// Returns the number of entries.
+		//
+		size_t size() const { std::lock_guard _g( mutex ); return entries.size(); }
+
+	private:
+		// Inserts an entry as the most recently used one replacing the entry with the same key, 
+		// and evicts the least recently used ones that do not fit, must be called with the mutex held.
+		//
+		void insert_locked( entry&& value );
+
+		// Erases the entry, must be called with the mutex held.
+		//
+		void erase_locked( std::list<entry>::iterator it );
+	};
+};
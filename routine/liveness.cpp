@@ -0,0 +1,241 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "liveness.hpp"
+
+namespace vtil
+{
+	// Computes the liveness of the registers in the routine.
+	//
+	liveness_analysis::liveness_analysis( routine* rtn ) : rtn( rtn )
+	{
+		// Map every block to its index and assign a slot to every register accessed.
+		//
+		rtn->materialize_all();
+		size_t block_count = rtn->next_block_index;
+		std::vector<basic_block*> blocks( block_count, nullptr );
+		for ( auto& [vip, block] : rtn->explored_blocks )
+		{
+			blocks[ block->index ] = block;
+			for ( const instruction& ins : block->stream )
+				for ( const operand& op : ins.operands )
+					if ( op.is_register() && slot_of.try_emplace( op.reg.key(), ( uint32_t ) slot_count ).second )
+						slot_count++;
+		}
+
+		local_mask.assign( slot_count, 0 );
+		physical_mask.assign( slot_count, 0 );
+		for ( auto& [key, slot] : slot_of )
+		{
+			if ( key.flags() & register_local )
+				local_mask[ slot ] = ~0ull;
+			if ( key.flags() & register_physical )
+				physical_mask[ slot ] = ~0ull;
+		}
+
+		// Summarize each block as the registers it reads before writing and the ones it writes.
+		//
+		std::vector<uint64_t> gen( block_count * slot_count, 0 );
+		std::vector<uint64_t> kill( block_count * slot_count, 0 );
+		for ( basic_block* blk : blocks )
+		{
+			if ( !blk ) continue;
+			uint64_t* bgen = gen.data() + blk->index * slot_count;
+			uint64_t* bkill = kill.data() + blk->index * slot_count;
+
+			for ( auto it = blk->stream.rbegin(); it != blk->stream.rend(); ++it )
+			{
+				// Registers generated by the block are the ones read before any write, 
+				// which is found by applying the transfer functions backwards to an empty set.
+				//
+				transfer( bgen, *it );
+				for ( int i = 0; i < it->base->access_types.size(); i++ )
+				{
+					if ( it->base->access_types[ i ] >= operand_access::write && it->operands[ i ].is_register() )
+						bkill[ slot_of.at( it->operands[ i ].reg.key() ) ] |= mask_of( it->operands[ i ].reg );
+				}
+			}
+		}
+
+		// Order blocks in post-order of the control flow graph, so that successors 
+		// are mostly processed before their predecessors, unreachable blocks last.
+		//
+		std::vector<basic_block*> order;
+		{
+			std::vector<bool> visited( block_count, false );
+			std::vector<std::pair<basic_block*, size_t>> stack;
+			auto dfs = [ & ] ( basic_block* root )
+			{
+				if ( visited[ root->index ] ) return;
+				visited[ root->index ] = true;
+				stack.push_back( { root, 0 } );
+				while ( !stack.empty() )
+				{
+					auto& [blk, n] = stack.back();
+					if ( n == blk->next.size() )
+					{
+						order.push_back( blk );
+						stack.pop_back();
+						continue;
+					}
+					basic_block* dst = blk->next[ n++ ];
+					if ( !visited[ dst->index ] )
+					{
+						visited[ dst->index ] = true;
+						stack.push_back( { dst, 0 } );
+					}
+				}
+			};
+			if ( rtn->entry_point )
+				dfs( rtn->entry_point );
+			for ( basic_block* blk : blocks )
+				if ( blk ) dfs( blk );
+		}
+
+		// Solve using a worklist.
+		//
+		live_in.assign( block_count * slot_count, 0 );
+		live_out.assign( block_count * slot_count, 0 );
+		std::vector<basic_block*> worklist( order.rbegin(), order.rend() );
+		std::vector<bool> queued( block_count, true );
+		while ( !worklist.empty() )
+		{
+			basic_block* blk = worklist.back();
+			worklist.pop_back();
+			queued[ blk->index ] = false;
+
+			uint64_t* bout = live_out.data() + blk->index * slot_count;
+			uint64_t* bin = live_in.data() + blk->index * slot_count;
+			const uint64_t* bgen = gen.data() + blk->index * slot_count;
+			const uint64_t* bkill = kill.data() + blk->index * slot_count;
+
+			// Out is the union of the successors' in, or the physical registers if this 
+			// is an exit, excluding the local registers.
+			//
+			if ( blk->next.empty() )
+			{
+				std::copy( physical_mask.begin(), physical_mask.end(), bout );
+			}
+			else
+			{
+				std::fill( bout, bout + slot_count, 0 );
+				for ( basic_block* dst : blk->next )
+				{
+					const uint64_t* din = live_in.data() + dst->index * slot_count;
+					for ( size_t s = 0; s != slot_count; s++ )
+						bout[ s ] |= din[ s ];
+				}
+			}
+			for ( size_t s = 0; s != slot_count; s++ )
+				bout[ s ] &= ~local_mask[ s ];
+
+			// In is the registers generated and the ones live at the exit that are not killed.
+			//
+			bool changed = false;
+			for ( size_t s = 0; s != slot_count; s++ )
+			{
+				uint64_t value = bgen[ s ] | ( bout[ s ] & ~bkill[ s ] );
+				changed |= value != bin[ s ];
+				bin[ s ] = value;
+			}
+
+			// If changed, queue the predecessors.
+			//
+			if ( changed )
+			{
+				for ( basic_block* src : blk->prev )
+				{
+					if ( !queued[ src->index ] )
+					{
+						queued[ src->index ] = true;
+						worklist.push_back( src );
+					}
+				}
+			}
+		}
+	}
+
+	// Applies the transfer function of the instruction to the set.
+	//
+	void liveness_analysis::transfer( uint64_t* set, const instruction& ins ) const
+	{
+		// Kill the registers written to first.
+		//
+		for ( int i = 0; i < ins.base->access_types.size(); i++ )
+		{
+			if ( ins.base->access_types[ i ] >= operand_access::write && ins.operands[ i ].is_register() )
+				set[ slot_of.at( ins.operands[ i ].reg.key() ) ] &= ~mask_of( ins.operands[ i ].reg );
+		}
+
+		// Then mark the registers read from as live.
+		//
+		for ( int i = 0; i < ins.base->access_types.size(); i++ )
+		{
+			if ( ins.base->access_types[ i ] != operand_access::write && ins.operands[ i ].is_register() )
+				set[ slot_of.at( ins.operands[ i ].reg.key() ) ] |= mask_of( ins.operands[ i ].reg );
+		}
+
+		// External calls may read any physical register.
+		//
+		if ( ins.base == &ins::vxcall )
+		{
+			for ( size_t s = 0; s != slot_count; s++ )
+				set[ s ] |= physical_mask[ s ];
+		}
+	}
+
+	// Returns the mask of the bits of the register that are live in the set.
+	//
+	uint64_t liveness_analysis::live_bits( const uint64_t* set, const register_desc& reg ) const
+	{
+		if ( reg.is_volatile() || reg.is_stack_pointer() )
+			return mask_of( reg );
+		// Registers that are not accessed within the routine are only 
+		// live if they are physical as they are live at the exits.
+		//
+		auto it = slot_of.find( reg.key() );
+		if ( it == slot_of.end() )
+			return reg.is_physical() ? mask_of( reg ) : 0;
+		return set[ it->second ] & mask_of( reg );
+	}
+
+	// Returns the mask of the bits of the register that are live right before the instruction executes.
+	//
+	uint64_t liveness_analysis::live_bits_at( const basic_block::const_iterator& it, const register_desc& reg ) const
+	{
+		// Walk back from the exit of the block applying the transfer functions.
+		//
+		const basic_block* blk = it.container;
+		std::vector<uint64_t> set( out( blk ), out( blk ) + slot_count );
+		for ( auto i = blk->end(); i != it; )
+		{
+			--i;
+			transfer( set.data(), *i );
+		}
+		return live_bits( set.data(), reg );
+	}
+};
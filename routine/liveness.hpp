@@ -0,0 +1,105 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include "basic_block.hpp"
+#include "..\arch\register_map.hpp"
+
+namespace vtil
+{
+	// Global register liveness of a routine, solved as a backwards dataflow problem over the control 
+	// flow graph. Every distinct register is assigned a slot and each slot is represented by a single 
+	// 64-bit word where each bit indicates whether the matching bit of the register is live, so that
+	// partial registers are tracked precisely and the set operations are plain word-wise loops.
+	// - Local registers are never live across block boundaries.
+	// - Physical registers are live at the exits of the routine and are considered read by vxcall.
+	//   Physical registers the routine never accesses are reported as live everywhere.
+	// - Pinning instructions are treated as regular accesses, vpinr reading and vpinw overwriting.
+	// - Volatile registers and the stack pointer are always considered live.
+	// - Analysis is a snapshot, it has to be recomputed after the routine is modified.
+	//
+	struct liveness_analysis
+	{
+		// Routine analyzed.
+		//
+		routine* rtn;
+
+		// Slot assigned to each register and the number of slots.
+		//
+		register_map<uint32_t> slot_of;
+		size_t slot_count = 0;
+
+		// Masks of local and physical register slots.
+		//
+		std::vector<uint64_t> local_mask;
+		std::vector<uint64_t> physical_mask;
+
+		// Sets of live registers at the entry and exit of each block indexed by the block index.
+		//
+		std::vector<uint64_t> live_in;
+		std::vector<uint64_t> live_out;
+
+		// Computes the liveness of the registers in the routine.
+		//
+		liveness_analysis( routine* rtn );
+
+		// Returns the set of live registers at the entry or the exit of the block.
+		//
+		const uint64_t* in( const basic_block* blk ) const { return live_in.data() + blk->index * slot_count; }
+		const uint64_t* out( const basic_block* blk ) const { return live_out.data() + blk->index * slot_count; }
+
+		// Returns the mask of the bits of the register that are live at the entry or the exit of the block.
+		//
+		uint64_t live_bits_in( const basic_block* blk, const register_desc& reg ) const { return live_bits( in( blk ), reg ); }
+		uint64_t live_bits_out( const basic_block* blk, const register_desc& reg ) const { return live_bits( out( blk ), reg ); }
+
+		// Returns the mask of the bits of the register that are live right before the instruction executes,
+		// passing the end iterator of the block queries the liveness at the exit of the block.
+		//
+		uint64_t live_bits_at( const basic_block::const_iterator& it, const register_desc& reg ) const;
+
+		// Returns whether or not any bit of the register is live at the position.
+		//
+		bool is_live_in( const basic_block* blk, const register_desc& reg ) const { return live_bits_in( blk, reg ) != 0; }
+		bool is_live_out( const basic_block* blk, const register_desc& reg ) const { return live_bits_out( blk, reg ) != 0; }
+		bool is_live_at( const basic_block::const_iterator& it, const register_desc& reg ) const { return live_bits_at( it, reg ) != 0; }
+
+		// Returns the mask of the bits the register occupies in its slot.
+		//
+		static uint64_t mask_of( const register_desc& reg ) { return ( reg.bit_count == 64 ? ~0ull : ( 1ull << reg.bit_count ) - 1 ) << reg.bit_offset; }
+
+	private:
+		// Returns the mask of the bits of the register that are live in the set.
+		//
+		uint64_t live_bits( const uint64_t* set, const register_desc& reg ) const;
+
+		// Applies the transfer function of the instruction to the set.
+		//
+		void transfer( uint64_t* set, const instruction& ins ) const;
+	};
+};
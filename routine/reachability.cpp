@@ -0,0 +1,335 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "reachability.hpp"
+#include "basic_block.hpp"
+
+namespace vtil
+{
+	// Drops the index so that it is rebuilt on the next query.
+	//
+	void reachability_index::invalidate()
+	{
+		std::lock_guard _g( mutex );
+		is_valid = false;
+	}
+
+	// Builds the index if it is not valid, must be called with the mutex held.
+	//
+	void reachability_index::build()
+	{
+		// Map every block to its index.
+		//
+		size_t block_count = rtn->next_block_index;
+		blocks.assign( block_count, nullptr );
+		component_of.assign( block_count, invalid_component );
+		for ( auto& [vip, block] : rtn->explored_blocks )
+			blocks[ block->index ] = block;
+
+		// Find the strongly connected components using an iterative version of Tarjan's algorithm, 
+		// components are discovered in reverse topological order so every successor of a 
+		// component has a smaller identifier than the component itself.
+		//
+		std::vector<uint32_t> discovery( block_count, invalid_component );
+		std::vector<uint32_t> lowlink( block_count );
+		std::vector<uint32_t> scc_stack;
+		std::vector<std::pair<uint32_t, size_t>> call_stack;
+		uint32_t discovery_counter = 0;
+		component_count = 0;
+
+		for ( size_t root = 0; root != block_count; root++ )
+		{
+			if ( !blocks[ root ] || discovery[ root ] != invalid_component )
+				continue;
+
+			call_stack.push_back( { root, 0 } );
+			discovery[ root ] = lowlink[ root ] = discovery_counter++;
+			scc_stack.push_back( root );
+
+			while ( !call_stack.empty() )
+			{
+				auto& [n, edge] = call_stack.back();
+				const auto& next = blocks[ n ]->next;
+
+				// Visit the next successor.
+				//
+				if ( edge != next.size() )
+				{
+					uint32_t s = next[ edge++ ]->index;
+					if ( discovery[ s ] == invalid_component )
+					{
+						discovery[ s ] = lowlink[ s ] = discovery_counter++;
+						scc_stack.push_back( s );
+						call_stack.push_back( { s, 0 } );
+					}
+					else if ( component_of[ s ] == invalid_component )
+					{
+						lowlink[ n ] = std::min( lowlink[ n ], discovery[ s ] );
+					}
+					continue;
+				}
+
+				// If this is the root of a component, pop it.
+				//
+				uint32_t node = n;
+				if ( lowlink[ node ] == discovery[ node ] )
+				{
+					uint32_t member;
+					do
+					{
+						member = scc_stack.back();
+						scc_stack.pop_back();
+						component_of[ member ] = component_count;
+					}
+					while ( member != node );
+					component_count++;
+				}
+
+				// Return to the caller and propagate the low link.
+				//
+				call_stack.pop_back();
+				if ( !call_stack.empty() )
+				{
+					uint32_t parent = call_stack.back().first;
+					lowlink[ parent ] = std::min( lowlink[ parent ], lowlink[ node ] );
+				}
+			}
+		}
+
+		// Allocate the rows leaving space for the components discovered later on.
+		//
+		component_capacity = std::max<size_t>( component_count * 2, 64 );
+		row_words = ( component_capacity + 63 ) / 64;
+		descendants.assign( component_capacity * row_words, 0 );
+		ancestors.assign( component_capacity * row_words, 0 );
+
+		// Group blocks by their component.
+		//
+		std::vector<uint32_t> member_offsets( component_count + 1, 0 );
+		std::vector<uint32_t> members( block_count );
+		for ( size_t i = 0; i != block_count; i++ )
+			if ( blocks[ i ] ) member_offsets[ component_of[ i ] + 1 ]++;
+		for ( size_t c = 0; c != component_count; c++ )
+			member_offsets[ c + 1 ] += member_offsets[ c ];
+		{
+			std::vector<uint32_t> cursor( member_offsets.begin(), member_offsets.end() - 1 );
+			for ( size_t i = 0; i != block_count; i++ )
+				if ( blocks[ i ] ) members[ cursor[ component_of[ i ] ]++ ] = i;
+		}
+		auto for_each_successor = [ & ] ( size_t c, auto&& fn )
+		{
+			for ( size_t m = member_offsets[ c ]; m != member_offsets[ c + 1 ]; m++ )
+				for ( basic_block* dst : blocks[ members[ m ] ]->next )
+					if ( component_of[ dst->index ] != c )
+						fn( component_of[ dst->index ] );
+		};
+
+		// Successors are always discovered first, so descendants can be computed in 
+		// the discovery order and the ancestors in the reverse order.
+		//
+		for ( size_t c = 0; c != component_count; c++ )
+		{
+			uint64_t* row = descendants_of( c );
+			set( row, c );
+			for_each_successor( c, [ & ] ( size_t s )
+			{
+				const uint64_t* srow = descendants_of( s );
+				for ( size_t w = 0; w != row_words; w++ )
+					row[ w ] |= srow[ w ];
+			} );
+		}
+		for ( size_t c = component_count; c--; )
+		{
+			uint64_t* row = ancestors_of( c );
+			set( row, c );
+			for_each_successor( c, [ & ] ( size_t s )
+			{
+				uint64_t* srow = ancestors_of( s );
+				for ( size_t w = 0; w != row_words; w++ )
+					srow[ w ] |= row[ w ];
+			} );
+		}
+		is_valid = true;
+	}
+
+	// Returns the component of the block, creating a new component for blocks
+	// that were not known when the index was built, must be called with the mutex held.
+	//
+	uint32_t reachability_index::component( const basic_block* blk )
+	{
+		if ( blk->index < component_of.size() && component_of[ blk->index ] != invalid_component )
+			return component_of[ blk->index ];
+
+		// Fail if there is no space left in the rows.
+		//
+		if ( component_count == component_capacity )
+			return invalid_component;
+
+		// Create a new component only containing the block.
+		//
+		if ( blk->index >= component_of.size() )
+		{
+			blocks.resize( blk->index + 1, nullptr );
+			component_of.resize( blk->index + 1, invalid_component );
+		}
+		uint32_t c = component_count++;
+		blocks[ blk->index ] = ( basic_block* ) blk;
+		component_of[ blk->index ] = c;
+		set( descendants_of( c ), c );
+		set( ancestors_of( c ), c );
+		return c;
+	}
+
+	// Hook invoked when an edge is added between two blocks.
+	//
+	void reachability_index::on_edge( basic_block* src, basic_block* dst )
+	{
+		// If the index is not built, there is nothing to update.
+		//
+		if ( !is_valid.load( std::memory_order_acquire ) )
+			return;
+		std::lock_guard _g( mutex );
+		if ( !is_valid )
+			return;
+
+		// Resolve the components, if we ran out of space rebuild on the next query.
+		//
+		uint32_t cs = component( src );
+		uint32_t cd = component( dst );
+		if ( cs == invalid_component || cd == invalid_component )
+		{
+			is_valid = false;
+			return;
+		}
+
+		// If the destination already is reachable, there is nothing to update.
+		//
+		if ( test( descendants_of( cs ), cd ) )
+			return;
+
+		// If the source is reachable from the destination, the edge forms a cycle
+		// and merges components, rebuild on the next query.
+		//
+		if ( test( descendants_of( cd ), cs ) )
+		{
+			is_valid = false;
+			return;
+		}
+
+		// Every ancestor of the source can now reach every descendant of the destination.
+		//
+		const uint64_t* src_ancestors = ancestors_of( cs );
+		const uint64_t* dst_descendants = descendants_of( cd );
+		for ( size_t c = 0; c != component_count; c++ )
+		{
+			if ( test( src_ancestors, c ) )
+			{
+				uint64_t* row = descendants_of( c );
+				for ( size_t w = 0; w != row_words; w++ )
+					row[ w ] |= dst_descendants[ w ];
+			}
+		}
+		for ( size_t c = 0; c != component_count; c++ )
+		{
+			if ( test( dst_descendants, c ) )
+			{
+				uint64_t* row = ancestors_of( c );
+				for ( size_t w = 0; w != row_words; w++ )
+					row[ w ] |= src_ancestors[ w ];
+			}
+		}
+	}
+
+	// Returns whether or not there is a path from the source to the destination.
+	//
+	bool reachability_index::reaches( const basic_block* src, const basic_block* dst )
+	{
+		rtn->materialize_all();
+		std::lock_guard _g( mutex );
+		if ( !is_valid )
+			build();
+
+		uint32_t cs = component( src );
+		uint32_t cd = component( dst );
+		if ( cs == invalid_component || cd == invalid_component )
+		{
+			build();
+			cs = component( src );
+			cd = component( dst );
+		}
+		return test( descendants_of( cs ), cd );
+	}
+
+	// Returns the set of blocks that are on a path from the source to the destination,
+	// following .next links if forward is set or the .prev links otherwise.
+	//
+	block_set reachability_index::path_to( const basic_block* src, const basic_block* dst, bool forward )
+	{
+		block_set output;
+
+		// If source is the destination, the path consists of it only.
+		//
+		if ( src == dst )
+		{
+			output.insert( src->index );
+			return output;
+		}
+
+		rtn->materialize_all();
+		std::lock_guard _g( mutex );
+		if ( !is_valid )
+			build();
+
+		uint32_t cs = component( src );
+		uint32_t cd = component( dst );
+		if ( cs == invalid_component || cd == invalid_component )
+		{
+			build();
+			cs = component( src );
+			cd = component( dst );
+		}
+
+		// Intersect the components reachable from the source with the 
+		// components the destination is reachable from.
+		//
+		const uint64_t* from = forward ? descendants_of( cs ) : ancestors_of( cs );
+		const uint64_t* to = forward ? ancestors_of( cd ) : descendants_of( cd );
+		if ( !test( from, cd ) )
+			return output;
+
+		std::vector<uint64_t> mask( row_words );
+		for ( size_t w = 0; w != row_words; w++ )
+			mask[ w ] = from[ w ] & to[ w ];
+
+		// Expand the components into blocks.
+		//
+		for ( size_t i = 0; i != blocks.size(); i++ )
+			if ( blocks[ i ] && component_of[ i ] != invalid_component && test( mask.data(), component_of[ i ] ) )
+				output.insert( i );
+		return output;
+	}
+};
@@ -0,0 +1,157 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+namespace vtil
+{
+	// Forward declarations.
+	//
+	struct basic_block;
+	struct routine;
+
+	// Set of basic blocks of a routine, represented as a bitset indexed by the block index.
+	//
+	struct block_set
+	{
+		std::vector<uint64_t> words;
+
+		// Basic set operations.
+		//
+		bool contains( size_t index ) const { return ( index >> 6 ) < words.size() && ( words[ index >> 6 ] >> ( index & 63 ) ) & 1; }
+		void insert( size_t index )
+		{
+			if ( ( index >> 6 ) >= words.size() ) 
+				words.resize( ( index >> 6 ) + 1 );
+			words[ index >> 6 ] |= 1ull << ( index & 63 );
+		}
+		void erase( size_t index )
+		{
+			if ( ( index >> 6 ) < words.size() ) 
+				words[ index >> 6 ] &= ~( 1ull << ( index & 63 ) );
+		}
+		void clear() { std::fill( words.begin(), words.end(), 0 ); }
+		bool empty() const
+		{
+			for ( uint64_t word : words )
+				if ( word ) return false;
+			return true;
+		}
+		block_set& operator&=( const block_set& o )
+		{
+			if ( words.size() > o.words.size() )
+				words.resize( o.words.size() );
+			for ( size_t i = 0; i != words.size(); i++ )
+				words[ i ] &= o.words[ i ];
+			return *this;
+		}
+	};
+
+	// Reachability index of a routine, built lazily on the first query over the condensation of 
+	// the control flow graph so that each strongly connected component is represented by a single 
+	// row. Each component holds a bitset of components reachable from it and a bitset of the ones 
+	// it is reachable from, so that path queries reduce to a single intersection of rows.
+	// - Memory used is quadratic in the number of components.
+	// - Edges added via ->fork(...) update the index incrementally, unless the edge merges
+	//   components in which case the index is rebuilt on the next query.
+	// - Any other modification of the edges must be followed by a call to ::invalidate().
+	//
+	struct reachability_index
+	{
+		// Routine this index belongs to.
+		//
+		routine* rtn;
+
+		// Mutex guarding the index and the flag indicating whether it is built, 
+		// which can be read without acquiring the mutex.
+		//
+		std::mutex mutex;
+		std::atomic<bool> is_valid = false;
+
+		// Blocks and the component they belong to, indexed by the block index.
+		//
+		std::vector<basic_block*> blocks;
+		std::vector<uint32_t> component_of;
+		static constexpr uint32_t invalid_component = ~0u;
+
+		// Number of components, number of components rows have space for and the
+		// number of words each row consists of.
+		//
+		size_t component_count = 0;
+		size_t component_capacity = 0;
+		size_t row_words = 0;
+
+		// Rows of descendants and ancestors of each component, including itself.
+		//
+		std::vector<uint64_t> descendants;
+		std::vector<uint64_t> ancestors;
+
+		// Construction.
+		//
+		reachability_index( routine* rtn ) : rtn( rtn ) {}
+
+		// Drops the index so that it is rebuilt on the next query.
+		//
+		void invalidate();
+
+		// Hook invoked when an edge is added between two blocks.
+		//
+		void on_edge( basic_block* src, basic_block* dst );
+
+		// Returns whether or not there is a path from the source to the destination.
+		//
+		bool reaches( const basic_block* src, const basic_block* dst );
+
+		// Returns the set of blocks that are on a path from the source to the destination,
+		// following .next links if forward is set or the .prev links otherwise. Result is 
+		// empty if the destination is not reachable.
+		//
+		block_set path_to( const basic_block* src, const basic_block* dst, bool forward );
+
+	private:
+		// Row helpers.
+		//
+		uint64_t* descendants_of( size_t component ) { return &descendants[ component * row_words ]; }
+		uint64_t* ancestors_of( size_t component ) { return &ancestors[ component * row_words ]; }
+		static bool test( const uint64_t* row, size_t n ) { return ( row[ n >> 6 ] >> ( n & 63 ) ) & 1; }
+		static void set( uint64_t* row, size_t n ) { row[ n >> 6 ] |= 1ull << ( n & 63 ); }
+
+		// Builds the index if it is not valid, must be called with the mutex held.
+		//
+		void build();
+
+		// Returns the component of the block, creating a new component for blocks
+		// that were not known when the index was built, must be called with the mutex held.
+		//
+		uint32_t component( const basic_block* blk );
+	};
+};
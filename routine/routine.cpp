@@ -29,11 +29,24 @@
 
 namespace vtil
 {
+	// Allocates a basic block within the routine arena, the block is not 
+	// inserted into the explored block list.
+	//
+	basic_block* routine::allocate_block( vip_t entry_vip )
+	{
+		return std::pmr::polymorphic_allocator<basic_block>{ &allocator }.new_object<basic_block>( this, entry_vip );
+	}
+
 	// Routine structures free all basic blocks they own upon their destruction.
+	// - The pool stops taking deallocations first, so destroying the blocks only releases 
+	//   what they own outside the arena and the arena is then released in bulk.
+	// - The source is released first as it frees the blocks it has not materialized.
 	//
 	routine::~routine()
 	{
+		allocator.is_releasing = true;
+		source.reset();
 		for ( auto [vip, block] : explored_blocks )
-			delete block;
+			std::destroy_at( block );
 	}
 };
@@ -26,11 +26,18 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
-#include <map>
+#include <atomic>
 #include <mutex>
+#include <memory_resource>
 #include <type_traits>
 #include <functional>
+#include <vector>
+#include <memory>
 #include "instruction.hpp"
+#include "block_table.hpp"
+#include "reachability.hpp"
+#include "dominance.hpp"
+#include "..\misc\thread_pool.hpp"
 
 namespace vtil
 {
@@ -42,13 +49,61 @@ namespace vtil
 	//
 	struct routine
 	{
+		// Thread-safe pool that drops deallocations once the arena it draws from is being 
+		// released, so that tearing down the blocks does not return their memory piece by piece.
+		//
+		struct arena_pool final : std::pmr::synchronized_pool_resource
+		{
+			using synchronized_pool_resource::synchronized_pool_resource;
+			bool is_releasing = false;
+
+		protected:
+			void do_deallocate( void* p, size_t size, size_t alignment ) override
+			{
+				if ( !is_releasing )
+					synchronized_pool_resource::do_deallocate( p, size, alignment );
+			}
+		};
+
+		// Arena that every basic block of this routine, their edge lists and their instruction streams 
+		// are allocated from, which is released all at once when the routine is destroyed. Allocations
+		// are made through the thread-safe pool so that blocks can be lifted in parallel.
+		//
+		std::pmr::monotonic_buffer_resource arena;
+		arena_pool allocator = arena_pool{ &arena };
+
 		// Mutex guarding the whole structure, more information on thread-safety can be found at basic_block.hpp.
 		//
 		std::mutex mutex;
 
 		// Cache of explored blocks, mapping virtual instruction pointer to the basic block structure.
+		// - Can be queried and inserted into without acquiring the mutex.
+		//
+		block_table explored_blocks = block_table{ &allocator };
+
+		// Number of times a thread had to spin on the .prev lock of a block.
 		//
-		std::map<vip_t, basic_block*> explored_blocks;
+		std::atomic<size_t> edge_contention_count = 0;
+
+		// Index assigned to the next basic block allocated, every block gets a unique 
+		// dense index so that sets of blocks can be represented as bitsets.
+		//
+		std::atomic<uint32_t> next_block_index = 0;
+
+		// Counter incremented every time the control flow graph changes, used 
+		// to invalidate the analyses cached on the routine.
+		//
+		std::atomic<uint64_t> cfg_epoch = 0;
+
+		// Analyses of the control flow graph.
+		//
+		reachability_index reachability = reachability_index{ this };
+		dominance_analysis dominance = dominance_analysis{ this };
+
+		// Source of the blocks that are not materialized yet if the routine is loaded lazily, 
+		// registered as the fallback of the explored block table, see archive.hpp.
+		//
+		std::unique_ptr<block_source> source;
 
 		// Reference to the first block, entry point.
 		// - Can be accessed without acquiring the mutex as it will be assigned strictly once.
@@ -64,14 +119,65 @@ namespace vtil
 		routine& operator=( const routine& ) = delete;
 
 		// Invokes the enumerator passed for each basic block this routine contains.
+		// - Explored block table can be safely iterated without acquiring the mutex.
 		//
-		void for_each( const std::function<void( basic_block* )>& enumerator )
+		template<typename enumerator_type>
+		void for_each( enumerator_type&& enumerator )
 		{
-			std::lock_guard _g( mutex );
+			materialize_all();
 			for ( auto& [vip, block] : explored_blocks )
 				enumerator( block );
 		}
 
+		// Invokes the enumerator passed for each basic block this routine contains in parallel,
+		// distributing the blocks over the thread pool in chunks of the given size.
+		// - As no block modifies the properties of another, block-local passes can be executed 
+		//   this way, see basic_block.hpp for more information.
+		//
+		template<typename enumerator_type>
+		void for_each_parallel( enumerator_type&& enumerator, size_t chunk_size = 64, thread_pool& pool = thread_pool::get_default() )
+		{
+			materialize_all();
+			std::vector<basic_block*> blocks;
+			blocks.reserve( explored_blocks.size() );
+			for ( auto& [vip, block] : explored_blocks )
+				blocks.push_back( block );
+
+			pool.parallel_for( blocks.size(), chunk_size, [ & ] ( size_t begin, size_t end )
+			{
+				for ( size_t i = begin; i != end; i++ )
+					enumerator( blocks[ i ] );
+			} );
+		}
+
+		// Returns the number of contended operations on the explored block
+		// table and the block edges since the creation of the routine.
+		//
+		size_t get_contention() const { return explored_blocks.contention_count + edge_contention_count; }
+
+		// Invalidates the analyses of the control flow graph, must be invoked after the 
+		// edges of a block are modified directly instead of via ->fork(...).
+		//
+		void invalidate_analyses() 
+		{ 
+			cfg_epoch++; 
+			reachability.invalidate(); 
+		}
+
+		// Materializes every block if the routine is loaded lazily, must be invoked before 
+		// iterating the explored block table to visit all blocks of such routines.
+		//
+		void materialize_all() const
+		{
+			if ( source )
+				source->fetch_all();
+		}
+
+		// Allocates a basic block within the routine arena, the block is not 
+		// inserted into the explored block list.
+		//
+		basic_block* allocate_block( vip_t entry_vip );
+
 		// Routine structures free all basic blocks they own upon their destruction.
 		//
 		~routine();
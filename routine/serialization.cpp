@@ -27,6 +27,11 @@
 //
 #include "serialization.hpp"
 #include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <unordered_set>
+#include <atomic>
+#include <mutex>
 
 #pragma warning(disable:4267)
 namespace vtil
@@ -34,74 +39,558 @@ namespace vtil
 	using magic_t = uint32_t;
 	static constexpr magic_t vtil_magic = 'LITV';
 
-	// Serialization of VTIL blocks.
+	// Size of the header of a serialized routine, consisting of the magic, the 
+	// version and the length of the rest.
+	//
+	static constexpr size_t routine_header_size = sizeof( magic_t ) + sizeof( uint32_t ) + sizeof( uint64_t );
+
+	// Operands are stored as their in-memory 16-byte representation in little-endian, 
+	// the register identifier and the immediate value overlap at the first 8 bytes.
+	//
+	static_assert( sizeof( size_t ) == sizeof( uint64_t ), "Register identifier must overlap the immediate value." );
+
+	// Block read along with the entry VIP of each block it references, before it is linked.
+	//
+	struct unlinked_block
+	{
+		basic_block* blk = nullptr;
+		std::vector<vip_t> prev;
+		std::vector<vip_t> next;
+	};
+
+	// Creates a new block within the owner from the record and registers it.
+	//
+	static bool read_block( byte_reader& in, routine* rtn, unlinked_block& out )
+	{
+		out.blk = rtn->allocate_block( invalid_vip );
+		if ( !deserialize( in, out.blk, out.prev, out.next ) || !rtn->explored_blocks.insert( out.blk->entry_vip, out.blk ).second )
+		{
+			in.failed = true;
+			out.blk = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	// Links the blocks read to the blocks they reference in a single pass over the
+	// explored block table, returns false if a referenced block is missing.
+	//
+	static bool link_blocks( routine* rtn, const std::vector<unlinked_block>& blocks )
+	{
+		for ( auto& entry : blocks )
+		{
+			for ( auto [vips, list] : { std::pair{ &entry.prev, &entry.blk->prev }, std::pair{ &entry.next, &entry.blk->next } } )
+			{
+				list->reserve( vips->size() );
+				for ( vip_t vip : *vips )
+				{
+					basic_block* ref = rtn->explored_blocks.find( vip );
+					if ( !ref )
+						return false;
+					list->push_back( ref );
+				}
+			}
+		}
+		rtn->invalidate_analyses();
+		return true;
+	}
+
+	// Reads a block and the blocks following it until every block referenced by the
+	// ones read is found, then links them, returns the first block or nullptr on failure.
+	// - Reader is invoked with the entry to read the next block into and returns whether it succeeded.
+	//
+	template<typename T>
+	static basic_block* read_resolved( routine* rtn, T&& read_next )
+	{
+		std::vector<unlinked_block> blocks;
+		std::unordered_set<vip_t> missing;
+		do
+		{
+			unlinked_block& entry = blocks.emplace_back();
+			if ( !read_next( entry ) )
+				return nullptr;
+
+			missing.erase( entry.blk->entry_vip );
+			for ( auto* vips : { &entry.prev, &entry.next } )
+				for ( vip_t vip : *vips )
+					if ( !rtn->explored_blocks.find( vip ) )
+						missing.insert( vip );
+		}
+		while ( !missing.empty() );
+
+		return link_blocks( rtn, blocks ) ? blocks.front().blk : nullptr;
+	}
+
+	// Serialization of VTIL operands.
+	//
+	void serialize( byte_writer& out, const operand& in )
+	{
+		// Write the operand in its memory layout field by field into the space allocated, which 
+		// is zeroed, so that the padding does not leak into the output. The 64-bit field is 
+		// written in little-endian.
+		//
+		uint8_t* raw = out.allocate( sizeof( operand ) );
+		raw[ offsetof( operand, kind ) ] = uint8_t( in.kind );
+		if ( in.kind == operand_kind::reg )
+		{
+			uint64_t id = impl::to_little_endian( uint64_t( in.reg.local_id ) );
+			memcpy( raw + offsetof( operand, reg ) + offsetof( register_desc, local_id ), &id, sizeof( id ) );
+			raw[ offsetof( operand, reg ) + offsetof( register_desc, flags ) ] = in.reg.flags;
+			raw[ offsetof( operand, reg ) + offsetof( register_desc, bit_count ) ] = in.reg.bit_count;
+			raw[ offsetof( operand, reg ) + offsetof( register_desc, bit_offset ) ] = in.reg.bit_offset;
+		}
+		else if ( in.kind == operand_kind::immediate )
+		{
+			uint64_t value = impl::to_little_endian( in.imm.u64 );
+			memcpy( raw + offsetof( operand, imm ) + offsetof( immediate_desc, u64 ), &value, sizeof( value ) );
+			raw[ offsetof( operand, imm ) + offsetof( immediate_desc, bit_count ) ] = in.imm.bit_count;
+		}
+	}
+	void deserialize( byte_reader& in, operand& out )
+	{
+		in.read( out );
+		if constexpr ( std::endian::native != std::endian::little )
+			out.imm.u64 = impl::byteswap( out.imm.u64 );
+	}
+	void serialize( std::ostream& out, const operand& in )
+	{
+		byte_writer buffer;
+		serialize( buffer, in );
+		out.write( ( const char* ) buffer.data(), buffer.size() );
+	}
+	void deserialize( std::istream& in, operand& out )
+	{
+		uint8_t raw[ sizeof( operand ) ];
+		in.read( ( char* ) raw, sizeof( raw ) );
+		byte_reader buffer = { raw, sizeof( raw ) };
+		deserialize( buffer, out );
+	}
+
+	// Table of block compressors, indexed by their identifiers. Lookups are lock-free
+	// while insertions are serialized by the mutex.
+	//
+	static std::mutex compressor_mutex;
+	static std::atomic<const block_compressor*> compressor_table[ 256 ] = {};
+
+	// Registers a block compressor under its identifier, returns false if the identifier is taken.
+	//
+	bool register_compressor( const block_compressor* compressor )
+	{
+		std::lock_guard _g( compressor_mutex );
+		auto& entry = compressor_table[ compressor->identifier() ];
+		if ( entry.load( std::memory_order_relaxed ) )
+			return false;
+		entry.store( compressor, std::memory_order_release );
+		return true;
+	}
+
+	// Looks up the block compressor registered under the identifier, returns nullptr if there is none.
 	//
-	void serialize( std::ostream& out, const basic_block* in )
+	const block_compressor* lookup_compressor( uint8_t identifier )
 	{
-		// Write rest of the properties as is.
+		return compressor_table[ identifier ].load( std::memory_order_acquire );
+	}
+
+	// Layout of the header byte of each instruction in the compact encoding, the
+	// operand count is stored in the lowest bits.
+	//
+	static constexpr uint8_t compact_operand_count_mask = 0x7;
+	static constexpr uint8_t compact_sp_reset =           1 << 3;
+	static constexpr uint8_t compact_explicit_volatile =  1 << 4;
+	static constexpr uint8_t compact_pseudo =             1 << 5;
+	static constexpr uint8_t compact_sp_changed =         1 << 6;
+	static_assert( max_operand_count <= compact_operand_count_mask, "Operand count does not fit the header." );
+
+	// Layout of the tag byte of each operand in the compact encoding, the kind is
+	// stored in the lowest bits and the rest holds the register flags or the immediate 
+	// size minus one. Operands that do not fit are stored verbatim.
+	//
+	static constexpr uint8_t compact_tag_invalid =   0;
+	static constexpr uint8_t compact_tag_register =  1;
+	static constexpr uint8_t compact_tag_immediate = 2;
+	static constexpr uint8_t compact_tag_verbatim =  3;
+	static constexpr uint8_t compact_tag_shift =     2;
+	static constexpr uint8_t compact_register_offset = 0x80;
+
+	// Writes an operand in the compact encoding.
+	//
+	static void write_compact( byte_writer& out, const operand& op )
+	{
+		if ( op.kind == operand_kind::invalid )
+		{
+			out.write<uint8_t>( compact_tag_invalid );
+		}
+		else if ( op.kind == operand_kind::reg && op.reg.is_valid() && op.reg.flags < ( 1 << ( 8 - compact_tag_shift ) ) )
+		{
+			// Write the flags in the tag followed by the identifier and the size, the offset
+			// is only written if it is non-zero which is indicated by the top bit of the size.
+			//
+			out.write<uint8_t>( compact_tag_register | ( op.reg.flags << compact_tag_shift ) );
+			out.write_varint( op.reg.local_id );
+			out.write<uint8_t>( op.reg.bit_count | ( op.reg.bit_offset ? compact_register_offset : 0 ) );
+			if ( op.reg.bit_offset )
+				out.write<uint8_t>( op.reg.bit_offset );
+		}
+		else if ( op.kind == operand_kind::immediate && 1 <= op.imm.bit_count && op.imm.bit_count <= 64 )
+		{
+			out.write<uint8_t>( compact_tag_immediate | ( ( op.imm.bit_count - 1 ) << compact_tag_shift ) );
+			out.write_svarint( op.imm.i64 );
+		}
+		else
+		{
+			out.write<uint8_t>( compact_tag_verbatim );
+			serialize( out, op );
+		}
+	}
+	static void read_compact( byte_reader& in, operand& op )
+	{
+		uint8_t tag = in.read<uint8_t>();
+		switch ( tag & ( ( 1 << compact_tag_shift ) - 1 ) )
+		{
+			case compact_tag_invalid:
+			{
+				op = {};
+				break;
+			}
+			case compact_tag_register:
+			{
+				register_desc reg;
+				reg.flags = tag >> compact_tag_shift;
+				reg.local_id = in.read_varint();
+				reg.bit_count = in.read<uint8_t>();
+				reg.bit_offset = ( reg.bit_count & compact_register_offset ) ? in.read<uint8_t>() : 0;
+				reg.bit_count &= ~compact_register_offset;
+				if ( !reg.is_valid() )
+				{
+					in.failed = true;
+					return;
+				}
+				op = reg;
+				break;
+			}
+			case compact_tag_immediate:
+			{
+				op = { in.read_svarint(), ( tag >> compact_tag_shift ) + 1 };
+				break;
+			}
+			case compact_tag_verbatim:
+			{
+				deserialize( in, op );
+				break;
+			}
+		}
+	}
+
+	// Writes the VIP's of the referenced blocks as deltas from the entry VIP.
+	//
+	static void write_compact( byte_writer& out, vip_t entry_vip, const std::pmr::vector<basic_block*>& list )
+	{
+		out.write_varint( list.size() );
+		for ( basic_block* blk : list )
+			out.write_svarint( int64_t( blk->entry_vip - entry_vip ) );
+	}
+	static void read_compact( byte_reader& in, vip_t entry_vip, std::vector<vip_t>& list )
+	{
+		// Every entry takes at least a byte which bounds the count.
+		//
+		uint64_t n = in.read_varint();
+		if ( n > in.remaining() )
+		{
+			in.failed = true;
+			return;
+		}
+		list.resize( n );
+		for ( vip_t& vip : list )
+			vip = entry_vip + vip_t( in.read_svarint() );
+	}
+
+	// Writes the properties of the block, its instructions and the VIP's of the referenced
+	// blocks in the compact encoding.
+	//
+	static void write_compact( byte_writer& out, const basic_block* in )
+	{
+		out.write_varint( in->entry_vip );
+		out.write_svarint( in->sp_offset );
+		out.write_varint( in->sp_index );
+		out.write_varint( in->last_temporary_index );
+
+		// Write the instructions, the stack fields are tracked from the start of the block
+		// and only written if they change.
+		//
+		int64_t sp_offset = 0;
+		uint32_t sp_index = 0;
+		out.write_varint( in->stream.size() );
+		in->stream.enumerate_resolved( [ & ] ( const instruction& ins )
+		{
+			bool sp_changed = ins.sp_offset != sp_offset || ins.sp_index != sp_index;
+			out.write_varint( ins.base->opcode );
+			out.write<uint8_t>( uint8_t( ins.operands.size() ) |
+								( ins.sp_reset ? compact_sp_reset : 0 ) |
+								( ins.explicit_volatile ? compact_explicit_volatile : 0 ) |
+								( ins.is_pseudo() ? compact_pseudo : 0 ) |
+								( sp_changed ? compact_sp_changed : 0 ) );
+			for ( auto& op : ins.operands )
+				write_compact( out, op );
+			if ( !ins.is_pseudo() )
+				out.write_svarint( int64_t( ins.vip - in->entry_vip ) );
+			if ( sp_changed )
+			{
+				out.write_svarint( ins.sp_offset - sp_offset );
+				out.write_svarint( int64_t( ins.sp_index ) - sp_index );
+				sp_offset = ins.sp_offset;
+				sp_index = ins.sp_index;
+			}
+		} );
+
+		write_compact( out, in->entry_vip, in->prev );
+		write_compact( out, in->entry_vip, in->next );
+	}
+	static void read_compact( byte_reader& in, basic_block* blk, std::vector<vip_t>& prev, std::vector<vip_t>& next )
+	{
+		blk->entry_vip = in.read_varint();
+		blk->sp_offset = in.read_svarint();
+		blk->sp_index = uint32_t( in.read_varint() );
+		blk->last_temporary_index = uint32_t( in.read_varint() );
+
+		// Read the instructions, every one takes at least two bytes which bounds the count.
+		//
+		int64_t sp_offset = 0;
+		uint32_t sp_index = 0;
+		uint64_t count = in.read_varint();
+		if ( count > in.remaining() / 2 )
+		{
+			in.failed = true;
+			return;
+		}
+		blk->stream.clear();
+		while ( count-- && in.is_valid() )
+		{
+			instruction ins;
+			uint64_t opcode = in.read_varint();
+			ins.base = opcode < max_opcode_count ? lookup_instruction( opcode_t( opcode ) ) : nullptr;
+			uint8_t header = in.read<uint8_t>();
+			if ( !ins.base || ( header & compact_operand_count_mask ) > max_operand_count )
+			{
+				in.failed = true;
+				return;
+			}
+
+			ins.operands.resize( header & compact_operand_count_mask );
+			for ( auto& op : ins.operands )
+				read_compact( in, op );
+			ins.vip = ( header & compact_pseudo ) ? invalid_vip : blk->entry_vip + vip_t( in.read_svarint() );
+			if ( header & compact_sp_changed )
+			{
+				sp_offset += in.read_svarint();
+				sp_index = uint32_t( sp_index + in.read_svarint() );
+			}
+			ins.sp_offset = sp_offset;
+			ins.sp_index = sp_index;
+			ins.sp_reset = header & compact_sp_reset;
+			ins.explicit_volatile = header & compact_explicit_volatile;
+			if ( !in.is_valid() || !ins.is_valid() )
+			{
+				in.failed = true;
+				return;
+			}
+			blk->stream.push_back( ins );
+		}
+
+		read_compact( in, blk->entry_vip, prev );
+		read_compact( in, blk->entry_vip, next );
+	}
+
+	// Writes the properties of the block, its instructions and the VIP's of the referenced
+	// blocks in the plain encoding.
+	//
+	static void write_plain( byte_writer& out, const basic_block* in )
+	{
+		// Write the properties as is.
 		//
 		serialize( out, in->entry_vip );
 		serialize( out, in->sp_offset );
 		serialize( out, in->sp_index );
 		serialize( out, in->last_temporary_index );
-		serialize( out, in->stream );
+
+		// Write the instructions with the queued stack shifts applied.
+		//
+		out.write<clength_t>( in->stream.size() );
+		in->stream.enumerate_resolved( [ & ] ( const instruction& ins ) { serialize( out, ins ); } );
 
 		// Write the entry VIP of each block reference instead of the pointer. 
 		//
-		serialize<clength_t>( out, in->prev.size() );
-		std::transform( in->prev.begin(), in->prev.end(), std::ostream_iterator<vip_t>( out ), [ ] ( auto it ) { return it->entry_vip; } );
-		serialize<clength_t>( out, in->next.size() );
-		std::transform( in->next.begin(), in->next.end(), std::ostream_iterator<vip_t>( out ), [ ] ( auto it ) { return it->entry_vip; } );
+		for ( auto& list : { &in->prev, &in->next } )
+		{
+			out.write<clength_t>( list->size() );
+			uint8_t* vips = out.allocate( list->size() * sizeof( vip_t ) );
+			for ( basic_block* blk : *list )
+			{
+				vip_t vip = impl::to_little_endian( blk->entry_vip );
+				memcpy( vips, &vip, sizeof( vip_t ) );
+				vips += sizeof( vip_t );
+			}
+		}
 	}
-	void deserialize( std::istream& in, routine* rtn, basic_block*& blk )
+	static void read_plain( byte_reader& in, basic_block* blk, std::vector<vip_t>& prev, std::vector<vip_t>& next )
 	{
-		// Create a new block, read basic properties and bind to the owner
-		//
-		blk = new basic_block;
 		deserialize( in, blk->entry_vip );
 		deserialize( in, blk->sp_offset );
 		deserialize( in, blk->sp_index );
 		deserialize( in, blk->last_temporary_index );
 		deserialize( in, blk->stream );
-		blk->owner = rtn;
-		blk->owner->explored_blocks[ blk->entry_vip ] = blk;
-
-		// Read referenced VIP's.
-		//
-		std::vector<vip_t> prev;
-		std::vector<vip_t> next;
 		deserialize( in, prev );
 		deserialize( in, next );
+	}
 
-		// Resolve each reference.
+	// Serialization of VTIL blocks.
+	//
+	void serialize( byte_writer& out, const basic_block* in, const serialization_options& options )
+	{
+		// Reserve space for the length of the record.
 		//
-		auto ref_resolve = [ &in, &rtn ] ( vip_t vip )
+		size_t length_offset = out.size();
+		out.write<uint32_t>( 0 );
+
+		// Write the encoding followed by the contents.
+		//
+		block_encoding encoding = options.compact ? block_encoding::compact : block_encoding::plain;
+		if ( !options.compressor )
 		{
-			// Reference the cached instance.
-			//
-			basic_block*& blk = rtn->explored_blocks[ vip ];
+			out.write( encoding );
+			if ( options.compact )
+				write_compact( out, in );
+			else
+				write_plain( out, in );
+		}
+		// If a compressor is given, encode the contents separately and write them 
+		// compressed, preceded by the compressor, the inner encoding and the original length.
+		//
+		else
+		{
+			byte_writer contents;
+			if ( options.compact )
+				write_compact( contents, in );
+			else
+				write_plain( contents, in );
 
-			// Keep reading next block until referenced block is found,
-			// once it is found break out of the loop and return the block.
-			//
-			while ( !blk )
-			{
-				basic_block* tmp;
-				deserialize( in, rtn, tmp );
-			}
-			return blk;
-		};
-		std::transform( prev.begin(), prev.end(), std::back_inserter( blk->prev ), ref_resolve );
-		std::transform( next.begin(), next.end(), std::back_inserter( blk->next ), ref_resolve );
+			out.write( block_encoding::compressed );
+			out.write<uint8_t>( options.compressor->identifier() );
+			out.write( encoding );
+			out.write_varint( contents.size() );
+			options.compressor->compress( contents.data(), contents.size(), out.buffer );
+		}
+
+		// Fill in the length of the record.
+		//
+		out.patch<uint32_t>( length_offset, out.size() - length_offset - sizeof( uint32_t ) );
+	}
+	bool deserialize( byte_reader& in, basic_block* blk, std::vector<vip_t>& prev, std::vector<vip_t>& next )
+	{
+		// Read the length of the record and limit the reader to it.
+		//
+		uint32_t length = in.read<uint32_t>();
+		const uint8_t* record = in.consume( length );
+		if ( !record )
+			return false;
+		byte_reader rin = { record, length };
+
+		// If the record is compressed, decompress the contents, whose length is bounded by 
+		// the limit of the record length, and continue reading from them instead.
+		//
+		block_encoding encoding = rin.read<block_encoding>();
+		std::vector<uint8_t> contents;
+		if ( encoding == block_encoding::compressed )
+		{
+			const block_compressor* compressor = lookup_compressor( rin.read<uint8_t>() );
+			encoding = rin.read<block_encoding>();
+			uint64_t contents_length = rin.read_varint();
+			if ( !rin.is_valid() || !compressor || encoding == block_encoding::compressed || contents_length > UINT32_MAX )
+				return false;
+
+			contents.resize( contents_length );
+			if ( !compressor->decompress( rin.cursor, rin.remaining(), contents.data(), contents.size() ) )
+				return false;
+			rin = { contents.data(), contents.size() };
+		}
+
+		// Read the properties, the instructions and the referenced VIP's.
+		//
+		switch ( encoding )
+		{
+			case block_encoding::plain:   read_plain( rin, blk, prev, next );   break;
+			case block_encoding::compact: read_compact( rin, blk, prev, next ); break;
+			default:                      return false;
+		}
+		return rin.is_valid() && !rin.remaining();
+	}
+	void deserialize( byte_reader& in, routine* rtn, basic_block*& blk )
+	{
+		// Read the block and the blocks that follow until each reference is resolved.
+		//
+		blk = read_resolved( rtn, [ & ] ( unlinked_block& entry ) { return read_block( in, rtn, entry ); } );
+		if ( !blk )
+			in.failed = true;
+	}
+	void serialize( std::ostream& out, const basic_block* in, const serialization_options& options )
+	{
+		byte_writer buffer;
+		serialize( buffer, in, options );
+		out.write( ( const char* ) buffer.data(), buffer.size() );
+	}
+	// Appends the given number of bytes read from the stream to the buffer, growing it in chunks
+	// as the data arrives so that a corrupt length fails at the end of the stream rather than 
+	// being allocated upfront, returns false if the stream ends first.
+	//
+	static bool read_bounded( std::istream& in, std::vector<uint8_t>& out, uint64_t length )
+	{
+		static constexpr size_t chunk_size = 1 << 20;
+		while ( length )
+		{
+			size_t count = size_t( std::min<uint64_t>( length, chunk_size ) );
+			size_t offset = out.size();
+			out.resize( offset + count );
+			if ( !in.read( ( char* ) out.data() + offset, count ) )
+				return false;
+			length -= count;
+		}
+		return true;
+	}
+	void deserialize( std::istream& in, routine* rtn, basic_block*& blk )
+	{
+		// Read the block and the blocks that follow from the stream until each reference is 
+		// resolved, reading the length of each record and then the record itself.
+		//
+		std::vector<uint8_t> raw;
+		blk = read_resolved( rtn, [ & ] ( unlinked_block& entry )
+		{
+			raw.resize( sizeof( uint32_t ) );
+			if ( !in.read( ( char* ) raw.data(), raw.size() ) )
+				return false;
+			uint32_t length = byte_reader{ raw.data(), raw.size() }.read<uint32_t>();
+			if ( !read_bounded( in, raw, length ) )
+				return false;
+
+			byte_reader buffer = { raw.data(), raw.size() };
+			return read_block( buffer, rtn, entry );
+		} );
+		if ( !blk )
+			in.setstate( std::ios::failbit );
 	}
 
 	// Serialization of VTIL routines.
 	//
-	void serialize( std::ostream& out, const routine* rtn )
+	void serialize( byte_writer& out, const routine* rtn, const serialization_options& options )
 	{
-		// Write the magic.
+		// Materialize the blocks if the routine is loaded lazily.
+		//
+		rtn->materialize_all();
+
+		// Write the magic, the version and reserve space for the length.
 		//
+		size_t header_offset = out.size();
 		serialize( out, vtil_magic );
+		serialize( out, serialization_version );
+		serialize<uint64_t>( out, 0 );
 
 		// Write the entry point VIP.
 		//
@@ -114,16 +603,24 @@ namespace vtil
 		// Dump all blocks in cached order.
 		//
 		for ( auto& pair : rtn->explored_blocks )
-			serialize( out, pair.second );
+			serialize( out, pair.second, options );
+
+		// Fill in the length.
+		//
+		out.patch<uint64_t>( header_offset + routine_header_size - sizeof( uint64_t ), out.size() - header_offset - routine_header_size );
 	}
-	routine* deserialize( std::istream& in, routine*& rtn )
+	routine* deserialize( byte_reader& in, routine*& rtn, size_t chunk_size, thread_pool& pool )
 	{
-		// Read and validate the magic.
+		rtn = nullptr;
+
+		// Read and validate the header, limiting the reader to the length specified.
 		//
-		magic_t magic;
-		deserialize( in, magic );
-		if ( magic != vtil_magic )
+		magic_t magic = in.read<magic_t>();
+		uint32_t version = in.read<uint32_t>();
+		uint64_t length = in.read<uint64_t>();
+		if ( !in.is_valid() || magic != vtil_magic || version != serialization_version || length > in.remaining() )
 			return nullptr;
+		byte_reader rin( in.consume( length ), length );
 
 		// Create a new routine.
 		//
@@ -131,60 +628,149 @@ namespace vtil
 
 		// Read the entry point VIP.
 		//
-		vip_t entry_vip;
-		deserialize( in, entry_vip );
+		vip_t entry_vip = rin.read<vip_t>();
 
-		// Read the number of blocks serialized and invoke basic-block 
-		// deserialization until number of blocks read matches.
+		// Read the number of blocks serialized, every record is at least as long as its 
+		// length prefix which bounds the count.
 		//
-		clength_t num_blocks;
-		deserialize( in, num_blocks );
-		while ( rtn->explored_blocks.size() != num_blocks )
+		clength_t num_blocks = rin.read<clength_t>();
+		if ( num_blocks < 0 || size_t( num_blocks ) > rin.remaining() / sizeof( uint32_t ) )
+			rin.failed = true;
+
+		// Split the records, which are prefixed with their length, so that they can be decoded independently.
+		//
+		std::vector<byte_reader> records( rin.is_valid() ? num_blocks : 0 );
+		for ( auto& record : records )
 		{
-			basic_block* tmp;
-			deserialize( in, rtn, tmp );
+			const uint8_t* begin = rin.cursor;
+			if ( !rin.consume( rin.read<uint32_t>() ) )
+				break;
+			record = { begin, size_t( rin.cursor - begin ) };
 		}
 
-		// Assign the fetched entry point from cache and return.
+		// Decode every block along with the VIP's it references in parallel, then link them all at once.
+		//
+		std::vector<unlinked_block> blocks( rin.is_valid() ? records.size() : 0 );
+		std::atomic<bool> failed = false;
+		pool.parallel_for( blocks.size(), chunk_size, [ & ] ( size_t begin, size_t end )
+		{
+			for ( size_t i = begin; i != end; i++ )
+				if ( !read_block( records[ i ], rtn, blocks[ i ] ) )
+					failed = true;
+		} );
+		if ( failed || ( rin.is_valid() && !link_blocks( rtn, blocks ) ) )
+			rin.failed = true;
+
+		// Assign the fetched entry point from cache and return, if the data was
+		// malformed, delete the routine instead.
 		//
-		rtn->entry_point = rtn->explored_blocks[ entry_vip ];
-		fassert( rtn->entry_point );
+		rtn->entry_point = rtn->explored_blocks.find( entry_vip );
+		if ( !rin.is_valid() || rtn->explored_blocks.size() != size_t( num_blocks ) || !rtn->entry_point )
+		{
+			delete rtn;
+			rtn = nullptr;
+		}
 		return rtn;
 	}
+	void serialize( std::ostream& out, const routine* rtn, const serialization_options& options )
+	{
+		byte_writer buffer;
+		serialize( buffer, rtn, options );
+		out.write( ( const char* ) buffer.data(), buffer.size() );
+	}
+	routine* deserialize( std::istream& in, routine*& rtn, size_t chunk_size, thread_pool& pool )
+	{
+		rtn = nullptr;
+
+		// Read the header and then the rest of the routine at once.
+		//
+		std::vector<uint8_t> raw( routine_header_size );
+		if ( !in.read( ( char* ) raw.data(), raw.size() ) )
+			return nullptr;
+		byte_reader header = { raw.data(), raw.size() };
+		if ( header.read<magic_t>() != vtil_magic || header.read<uint32_t>() != serialization_version )
+			return nullptr;
+		if ( !read_bounded( in, raw, header.read<uint64_t>() ) )
+			return nullptr;
+
+		byte_reader buffer = { raw.data(), raw.size() };
+		return deserialize( buffer, rtn, chunk_size, pool );
+	}
 
 	// Serialization of VTIL instructions.
 	//
-	static void serialize( std::ostream& out, const instruction& in )
+	void serialize( byte_writer& out, const instruction& in )
 	{
-		// Write only the name of the instruction instead of the pointer.
+		// Write only the opcode of the instruction instead of the pointer.
+		//
+		serialize( out, in.base->opcode );
+
+		// Write the operands.
 		//
-		serialize( out, in.base->name );
+		out.write<uint8_t>( in.operands.size() );
+		for ( auto& op : in.operands )
+			serialize( out, op );
 
-		// Write rest as is.
+		// Write rest as is, packing the flags into a single byte.
 		//
-		serialize( out, in.operands );
 		serialize( out, in.vip );
 		serialize( out, in.sp_offset );
 		serialize( out, in.sp_index );
-		serialize( out, in.sp_reset );
+		out.write<uint8_t>( ( in.sp_reset ? 1 : 0 ) | ( in.explicit_volatile ? 2 : 0 ) );
 	}
-	static void deserialize( std::istream& in, instruction& out )
+	void deserialize( byte_reader& in, instruction& out )
 	{
-		// Find the instruction by its name and write the pointer to the matched instance.
+		// Look up the instruction by its opcode and write the pointer to the matched instance.
 		//
-		std::string name;
-		deserialize( in, name );
-		out.base = std::find( std::begin( instruction_list ), std::end( instruction_list ), name );
-		fassert( out.base != std::end( instruction_list ) );
+		out.base = lookup_instruction( in.read<opcode_t>() );
+
+		// Read the operands.
+		//
+		uint8_t operand_count = in.read<uint8_t>();
+		if ( operand_count > max_operand_count )
+		{
+			in.failed = true;
+			return;
+		}
+		out.operands.resize( operand_count );
+		if constexpr ( std::endian::native == std::endian::little )
+			in.read_array( out.operands.data(), operand_count );
+		else
+			for ( auto& op : out.operands )
+				deserialize( in, op );
 
 		// Read rest as is and validate.
 		//
-		deserialize( in, out.operands );
 		deserialize( in, out.vip );
 		deserialize( in, out.sp_offset );
 		deserialize( in, out.sp_index );
-		deserialize( in, out.sp_reset );
-		fassert( out.is_valid() );
+		uint8_t flags = in.read<uint8_t>();
+		out.sp_reset = flags & 1;
+		out.explicit_volatile = flags & 2;
+		if ( !out.base || !out.is_valid() )
+			in.failed = true;
+	}
+	void serialize( std::ostream& out, const instruction& in )
+	{
+		byte_writer buffer;
+		serialize( buffer, in );
+		out.write( ( const char* ) buffer.data(), buffer.size() );
+	}
+	void deserialize( std::istream& in, instruction& out )
+	{
+		// Read the opcode and the operand count first to determine the length of the rest.
+		//
+		static constexpr size_t head_size = sizeof( opcode_t ) + sizeof( uint8_t );
+		static constexpr size_t tail_size = sizeof( vip_t ) + sizeof( int64_t ) + sizeof( uint32_t ) + sizeof( uint8_t );
+		uint8_t raw[ head_size + max_operand_count * sizeof( operand ) + tail_size ];
+		in.read( ( char* ) raw, head_size );
+		size_t length = head_size + std::min<size_t>( raw[ head_size - 1 ], max_operand_count ) * sizeof( operand ) + tail_size;
+		in.read( ( char* ) raw + head_size, length - head_size );
+
+		byte_reader buffer = { raw, in ? length : 0 };
+		deserialize( buffer, out );
+		if ( !buffer.is_valid() )
+			in.setstate( std::ios::failbit );
 	}
 };
 #pragma warning(default:4267)
\ No newline at end of file
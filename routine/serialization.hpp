@@ -33,6 +33,8 @@
 #include "routine.hpp"
 #include "basic_block.hpp"
 #include "instruction.hpp"
+#include "..\misc\byte_buffer.hpp"
+#include "..\misc\thread_pool.hpp"
 
 #pragma warning(disable:4267)
 namespace vtil
@@ -55,11 +57,12 @@ namespace vtil
 		template <typename T>
 		static constexpr bool is_std_container_v = _is_std_container<std::remove_cvref_t<T>>( true );
 
-		// Check if the type is a linear container. (std::vector or std::*string)
+		// Check if the type is a linear container. (std::vector, std::*string or vtil::fixed_vector)
 		//
 		template <typename T> struct _is_linear_container : std::false_type {};
 		template <typename T> struct _is_linear_container<std::vector<T>> : std::true_type {};
 		template <typename T> struct _is_linear_container<std::basic_string<T>> : std::true_type {};
+		template <typename T, size_t N> struct _is_linear_container<fixed_vector<T, N>> : std::true_type {};
 		
 		template <typename T>
 		static constexpr bool is_linear_container_v = _is_linear_container<std::remove_cvref_t<T>>::value;
@@ -84,6 +87,14 @@ namespace vtil
 		template <typename T>
 		static constexpr bool has_insert_value_v = _has_insert_value<std::remove_cvref_t<T>>( true );
 
+		// Check if the entries of the container are serialized as is and thus can be
+		// read and written all at once, which is the case for scalars only as the rest
+		// may have a serializer of their own.
+		//
+		template <typename T>
+		static constexpr bool is_bulk_serializable_v = is_linear_container_v<T> && 
+			( std::is_arithmetic_v<typename T::value_type> || std::is_enum_v<typename T::value_type> );
+
 		// Move the given value to the end of the container.
 		//
 		template<typename T>
@@ -128,6 +139,14 @@ namespace vtil
 		//
 		serialize<clength_t>( ss, v.size() );
 
+		// If entries are stored linearly and as is, write all at once.
+		//
+		if constexpr ( impl::is_bulk_serializable_v<T> )
+		{
+			ss.write( ( const char* ) v.data(), v.size() * sizeof( typename T::value_type ) );
+			return;
+		}
+
 		// Serialize each entry.
 		//
 		for( auto& entry : v ) 
@@ -143,9 +162,9 @@ namespace vtil
 		clength_t n;
 		deserialize( ss, n );
 
-		// If container stores data linearly and trivial data is stored:
+		// If entries are stored linearly and as is:
 		//
-		if constexpr ( impl::is_linear_container_v<T> && std::is_trivial<T>::value )
+		if constexpr ( impl::is_bulk_serializable_v<T> )
 		{
 			// Resize the container to expected size and read all entries at once.
 			//
@@ -168,19 +187,168 @@ namespace vtil
 		}
 	}
 
+	// Serialization of any type except standard containers and pointers into binary buffers.
+	//
+	template<typename T, std::enable_if_t<!std::is_pointer_v<T> && !impl::is_std_container_v<T>, int> = 0>
+	static void serialize( byte_writer& out, const T& v ) { out.write( v ); }
+	template<typename T, std::enable_if_t<!std::is_pointer_v<T> && !impl::is_std_container_v<T>, int> = 0>
+	static void deserialize( byte_reader& in, T& v ) { in.read( v ); }
+
+	// Serialization of standard containers into binary buffers.
+	//
+	template<typename T, std::enable_if_t<impl::is_std_container_v<T>, int> = 0>
+	static void serialize( byte_writer& out, const T& v )
+	{
+		// Serialize the number of entries.
+		//
+		out.write<clength_t>( v.size() );
+
+		// If entries are stored linearly and as is, copy all at once, else serialize each entry.
+		//
+		if constexpr ( impl::is_bulk_serializable_v<T> )
+			out.write_array( v.data(), v.size() );
+		else
+			for ( auto& entry : v )
+				serialize( out, entry );
+	}
+	template<typename T, std::enable_if_t<impl::is_std_container_v<T>, int> = 0>
+	static void deserialize( byte_reader& in, T& v )
+	{
+		using value_type = typename T::value_type;
+
+		// Deserialize the entry counter and reset the container.
+		//
+		clength_t n = in.read<clength_t>();
+		v.clear();
+		if ( n < 0 )
+		{
+			in.failed = true;
+			return;
+		}
+
+		// If entries are stored linearly and as is, validate the length against the
+		// buffer and copy all at once.
+		//
+		if constexpr ( impl::is_bulk_serializable_v<T> )
+		{
+			if ( in.remaining() < size_t( n ) * sizeof( value_type ) )
+			{
+				in.failed = true;
+				return;
+			}
+			v.resize( n );
+			in.read_array( v.data(), n );
+			return;
+		}
+
+		// Until counter reaches zero or the buffer is exhausted, deserialize an entry and then insert it at the end.
+		//
+		while ( n-- > 0 && in.is_valid() )
+		{
+			value_type value;
+			deserialize( in, value );
+			impl::move_back( v, std::move( value ) );
+		}
+	}
+
+	// Version of the binary format, written after the magic of each routine.
+	//
+	static constexpr uint32_t serialization_version = 3;
+
+	// Encoding of a block record, stored in the byte following its length.
+	// - Plain records store every field with its fixed width and the operands as is.
+	// - Compact records store integers as varints, instruction VIPs as deltas from the entry 
+	//   VIP of the block, stack fields only when they change between instructions and operands
+	//   as a tag byte followed by their value.
+	// - Compressed records hold a record of another encoding, compressed by the block
+	//   compressor registered under the identifier stored in the record.
+	//
+	enum class block_encoding : uint8_t
+	{
+		plain,
+		compact,
+		compressed,
+	};
+
+	// Interface of the general-purpose compressors that can be applied on top of block records.
+	//
+	struct block_compressor
+	{
+		// Identifier written into the compressed records, used to look the compressor up when reading.
+		//
+		virtual uint8_t identifier() const = 0;
+
+		// Appends the compressed form of the data to the output.
+		//
+		virtual void compress( const uint8_t* data, size_t length, std::vector<uint8_t>& out ) const = 0;
+
+		// Decompresses the data into the output which is sized to the original length,
+		// returns false if the data is malformed.
+		//
+		virtual bool decompress( const uint8_t* data, size_t length, uint8_t* out, size_t out_length ) const = 0;
+		
+		// Virtual destructor.
+		//
+		virtual ~block_compressor() = default;
+	};
+
+	// Registers a block compressor under its identifier, returns false if the identifier is taken.
+	// - Compressor must not be destroyed while it is registered.
+	//
+	bool register_compressor( const block_compressor* compressor );
+
+	// Looks up the block compressor registered under the identifier, returns nullptr if there is none.
+	//
+	const block_compressor* lookup_compressor( uint8_t identifier );
+
+	// Options controlling the encoding of the block records, reading accepts any combination.
+	//
+	struct serialization_options
+	{
+		// Whether the blocks are stored in the compact encoding or the plain one.
+		//
+		bool compact = false;
+
+		// Compressor to apply on top of the records if any, which must also be registered 
+		// wherever they are read.
+		//
+		const block_compressor* compressor = nullptr;
+	};
+
+	// Serialization of VTIL operands.
+	//
+	void serialize( std::ostream& out, const operand& in );
+	void deserialize( std::istream& in, operand& out );
+	void serialize( byte_writer& out, const operand& in );
+	void deserialize( byte_reader& in, operand& out );
+
 	// Serialization of VTIL blocks.
 	//
-	void serialize( std::ostream& out, const basic_block* in );
+	void serialize( std::ostream& out, const basic_block* in, const serialization_options& options = {} );
 	void deserialize( std::istream& in, routine* rtn, basic_block*& blk );
+	void serialize( byte_writer& out, const basic_block* in, const serialization_options& options = {} );
+	void deserialize( byte_reader& in, routine* rtn, basic_block*& blk );
+
+	// Deserializes a block record into the block given and the entry VIP of each block it 
+	// references without linking them, returns false if the record is malformed.
+	//
+	bool deserialize( byte_reader& in, basic_block* blk, std::vector<vip_t>& prev, std::vector<vip_t>& next );
 
 	// Serialization of VTIL routines.
+	// - Deserialization returns null if the data is malformed or of another version.
+	// - Blocks are decoded in parallel over the thread pool in chunks of the given size 
+	//   and then linked sequentially.
 	//
-	void serialize( std::ostream& out, const routine* rtn );
-	routine* deserialize( std::istream& in, routine*& rtn );
+	void serialize( std::ostream& out, const routine* rtn, const serialization_options& options = {} );
+	routine* deserialize( std::istream& in, routine*& rtn, size_t chunk_size = 64, thread_pool& pool = thread_pool::get_default() );
+	void serialize( byte_writer& out, const routine* rtn, const serialization_options& options = {} );
+	routine* deserialize( byte_reader& in, routine*& rtn, size_t chunk_size = 64, thread_pool& pool = thread_pool::get_default() );
 
 	// Serialization of VTIL instructions.
 	//
 	void serialize( std::ostream& out, const instruction& in );
 	void deserialize( std::istream& in, instruction& out );
+	void serialize( byte_writer& out, const instruction& in );
+	void deserialize( byte_reader& in, instruction& out );
 };
 #pragma warning(default:4267)
\ No newline at end of file
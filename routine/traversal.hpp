@@ -0,0 +1,201 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <type_traits>
+#include "basic_block.hpp"
+
+namespace vtil
+{
+	// Value returned by traversal visitors to control the walk.
+	// - proceed:   Continues the walk.
+	// - skip_path: Stops visiting the current block and does not follow the paths through it.
+	// - stop:      Terminates the walk.
+	//
+	enum class walk_control
+	{
+		proceed,
+		skip_path,
+		stop
+	};
+
+	// Lazy traversal engine walking the instructions of a routine starting from an iterator, crossing
+	// block boundaries as it reaches them. Paths are followed depth-first using an explicit stack and 
+	// the state is kept in the walker, so that walks reusing the same walker do not allocate.
+	// - Path restrictions of the origin iterator are respected.
+	// - If visit_once is set, each block is visited at most once, otherwise each block is visited once
+	//   for every distinct path leading to it, never entering a block twice within the same path.
+	// - When the walk reaches the origin block again, only the part that was not visited at the 
+	//   start is visited, which is the instructions before the origin for a forward walk and the 
+	//   instructions after it for a backward walk, and the path ends there.
+	//
+	template<typename _iterator_type>
+	struct block_walker
+	{
+		using iterator_type = _iterator_type;
+		using container_type = typename iterator_type::container_type;
+
+		// Stack frame, representing a block on the current path and the 
+		// index of the next successor to follow.
+		//
+		struct frame
+		{
+			container_type* block;
+			size_t successor;
+		};
+
+		// Traversal state.
+		//
+		std::vector<frame> stack;
+		block_set visited;
+		block_set on_path;
+
+		// Walks the instructions starting from the origin, following .next links if forward is set or 
+		// .prev links otherwise. Forward walks visit the origin and the instructions after it, backward
+		// walks visit the instructions before the origin in reverse order. Visitor is invoked with
+		// an iterator to each instruction and may return walk_control or nothing. Returns false if
+		// the walk was terminated by the visitor.
+		//
+		template<typename visitor_type>
+		bool walk( const iterator_type& origin, bool forward, visitor_type&& visitor, bool visit_once = true )
+		{
+			stack.clear();
+			visited.clear();
+			on_path.clear();
+
+			// Visit the origin block starting from the origin.
+			//
+			container_type* origin_block = origin.container;
+			walk_control result = forward
+				? visit( { origin_block, origin }, { origin_block, origin_block->stream.end() }, true, visitor )
+				: visit( { origin_block, origin_block->stream.begin() }, { origin_block, origin }, false, visitor );
+			if ( result == walk_control::stop )
+				return false;
+			if ( result == walk_control::skip_path )
+				return true;
+
+			visited.insert( origin_block->index );
+			on_path.insert( origin_block->index );
+			stack.push_back( { origin_block, 0 } );
+			bool origin_revisited = false;
+
+			while ( !stack.empty() )
+			{
+				frame& top = stack.back();
+				auto& links = forward ? top.block->successors() : top.block->predecessors();
+
+				// If all successors are followed, pop the block off the path.
+				//
+				if ( top.successor == links.size() )
+				{
+					on_path.erase( top.block->index );
+					stack.pop_back();
+					continue;
+				}
+				container_type* dst = links[ top.successor++ ];
+				dst->materialize();
+
+				// Skip if path is restricted and this path is not allowed.
+				//
+				if ( !origin.is_path_allowed( dst ) )
+					continue;
+
+				// If we reached the origin block, visit the remaining part and end the path.
+				//
+				if ( dst == origin_block )
+				{
+					if ( visit_once && origin_revisited )
+						continue;
+					origin_revisited = true;
+
+					result = forward
+						? visit( { dst, dst->stream.begin() }, { dst, origin }, true, visitor )
+						: visit( { dst, origin }, { dst, dst->stream.end() }, false, visitor );
+					if ( result == walk_control::stop )
+						return false;
+					continue;
+				}
+
+				// Skip if already visited as per the policy.
+				//
+				if ( ( visit_once ? visited : on_path ).contains( dst->index ) )
+					continue;
+				visited.insert( dst->index );
+
+				// Visit the whole block and follow its paths unless requested otherwise.
+				//
+				result = visit( { dst, dst->stream.begin() }, { dst, dst->stream.end() }, forward, visitor );
+				if ( result == walk_control::stop )
+					return false;
+				if ( result == walk_control::skip_path )
+					continue;
+				on_path.insert( dst->index );
+				stack.push_back( { dst, 0 } );
+			}
+			return true;
+		}
+
+	private:
+		// Visits the instructions in range [begin, end) in the given direction.
+		//
+		template<typename visitor_type>
+		static walk_control visit( iterator_type begin, iterator_type end, bool forward, visitor_type& visitor )
+		{
+			while ( begin != end )
+			{
+				if ( !forward )
+					--end;
+
+				iterator_type& it = forward ? begin : end;
+				if constexpr ( std::is_void_v<decltype( visitor( it ) )> )
+				{
+					visitor( it );
+				}
+				else
+				{
+					walk_control result = visitor( it );
+					if ( result != walk_control::proceed )
+						return result;
+				}
+
+				if ( forward )
+					++begin;
+			}
+			return walk_control::proceed;
+		}
+	};
+
+	// Walks the instructions starting from the origin using a temporary walker, see block_walker.
+	//
+	template<typename iterator_type, typename visitor_type>
+	bool walk( const iterator_type& origin, bool forward, visitor_type&& visitor, bool visit_once = true )
+	{
+		block_walker<iterator_type> walker;
+		return walker.walk( origin, forward, std::forward<visitor_type>( visitor ), visit_once );
+	}
+};
@@ -0,0 +1,513 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "interpreter.hpp"
+#include <cstring>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace vtil
+{
+	// Reads and writes the value with the given byte count in little-endian order.
+	//
+	uint8_t* sparse_memory::page_of( uint64_t address, bool allocate )
+	{
+		uint64_t index = address >> page_bits;
+		if ( index == cached_page_index )
+			return cached_page;
+
+		auto it = pages.find( index );
+		if ( it == pages.end() )
+		{
+			if ( !allocate )
+				return nullptr;
+			it = pages.emplace( index, std::make_unique<uint8_t[]>( page_size ) ).first;
+		}
+		cached_page_index = index;
+		cached_page = it->second.get();
+		return cached_page;
+	}
+	uint64_t sparse_memory::read( uint64_t address, size_t byte_count )
+	{
+		uint64_t value = 0;
+		size_t offset = address & ( page_size - 1 );
+		if ( offset + byte_count <= page_size )
+		{
+			if ( uint8_t* page = page_of( address, false ) )
+				memcpy( &value, page + offset, byte_count );
+			return value;
+		}
+
+		// Access crosses a page boundary, read byte by byte.
+		//
+		for ( size_t i = 0; i != byte_count; i++ )
+		{
+			uint8_t* page = page_of( address + i, false );
+			if ( page )
+				value |= uint64_t( page[ ( address + i ) & ( page_size - 1 ) ] ) << ( i * 8 );
+		}
+		return value;
+	}
+	void sparse_memory::write( uint64_t address, uint64_t value, size_t byte_count )
+	{
+		size_t offset = address & ( page_size - 1 );
+		if ( offset + byte_count <= page_size )
+		{
+			memcpy( page_of( address, true ) + offset, &value, byte_count );
+			return;
+		}
+
+		// Access crosses a page boundary, write byte by byte.
+		//
+		for ( size_t i = 0; i != byte_count; i++ )
+			page_of( address + i, true )[ ( address + i ) & ( page_size - 1 ) ] = uint8_t( value >> ( i * 8 ) );
+	}
+
+	namespace impl
+	{
+		using control = interpreter::control;
+		using decoded_instruction = interpreter::decoded_instruction;
+
+		// Width helpers.
+		//
+		static uint64_t mask_of( bitcnt_t n ) { return n >= 64 ? ~0ull : ( 1ull << n ) - 1; }
+		static int64_t sign_extend( uint64_t v, bitcnt_t n ) { return n >= 64 ? int64_t( v ) : int64_t( v << ( 64 - n ) ) >> ( 64 - n ); }
+		static size_t byte_count_of( bitcnt_t n ) { return n == 1 ? 1 : n / 8; }
+
+		// Full-width multiplication and division helpers.
+		//
+		static uint64_t umul128( uint64_t a, uint64_t b, uint64_t* hi )
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return _umul128( a, b, hi );
+#else
+			unsigned __int128 r = ( unsigned __int128 ) a * b;
+			*hi = uint64_t( r >> 64 );
+			return uint64_t( r );
+#endif
+		}
+		static uint64_t mul128( int64_t a, int64_t b, int64_t* hi )
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return ( uint64_t ) _mul128( a, b, hi );
+#else
+			__int128 r = ( __int128 ) a * b;
+			*hi = int64_t( r >> 64 );
+			return uint64_t( r );
+#endif
+		}
+		static uint64_t udiv128( uint64_t hi, uint64_t lo, uint64_t d, uint64_t* rem )
+		{
+#if defined(_MSC_VER) && !defined(__clang__)
+			return _udiv128( hi, lo, d, rem );
+#else
+			unsigned __int128 v = ( ( unsigned __int128 ) hi << 64 ) | lo;
+			*rem = uint64_t( v % d );
+			return uint64_t( v / d );
+#endif
+		}
+
+		// Divides the 2N-bit value [hi:lo] by d, returns false on division errors.
+		//
+		static bool divide( uint64_t hi, uint64_t lo, uint64_t d, bitcnt_t n, bool is_signed, uint64_t& quotient, uint64_t& remainder )
+		{
+			// Form the dividend as a 128-bit value.
+			//
+			bool negative_dividend = false, negative_divisor = false;
+			uint64_t vhi, vlo;
+			if ( n >= 64 )
+			{
+				vhi = hi;
+				vlo = lo;
+			}
+			else
+			{
+				uint64_t combined_lo = ( lo & mask_of( n ) ) | ( hi << n );
+				uint64_t combined_hi = n == 0 ? 0 : ( hi & mask_of( n ) ) >> ( 64 - n );
+				vhi = combined_hi;
+				vlo = combined_lo;
+				if ( is_signed && ( ( hi >> ( n - 1 ) ) & 1 ) )
+				{
+					// Sign extend the 2N-bit value to 128 bits.
+					//
+					if ( 2 * n < 64 )
+					{
+						vlo |= ~mask_of( 2 * n );
+						vhi = ~0ull;
+					}
+					else
+					{
+						vhi |= ~mask_of( 2 * n - 64 );
+					}
+				}
+			}
+			if ( is_signed )
+			{
+				d = uint64_t( sign_extend( d, n ) );
+				negative_dividend = int64_t( vhi ) < 0;
+				negative_divisor = int64_t( d ) < 0;
+				if ( negative_dividend )
+				{
+					vlo = ~vlo + 1;
+					vhi = ~vhi + ( vlo == 0 );
+				}
+				if ( negative_divisor )
+					d = ~d + 1;
+			}
+			else
+			{
+				d &= mask_of( n );
+			}
+
+			// Divide the magnitudes, the quotient has to fit in 64 bits.
+			//
+			if ( d == 0 || vhi >= d )
+				return false;
+			uint64_t q = udiv128( vhi, vlo, d, &remainder );
+
+			// Check the quotient fits in N bits and apply the signs.
+			//
+			if ( is_signed )
+			{
+				bool negative = negative_dividend != negative_divisor;
+				uint64_t limit = ( 1ull << ( n - 1 ) ) - ( negative ? 0 : 1 );
+				if ( q > limit )
+					return false;
+				quotient = negative ? ~q + 1 : q;
+				remainder = negative_dividend ? ~remainder + 1 : remainder;
+			}
+			else
+			{
+				if ( q > mask_of( n ) )
+					return false;
+				quotient = q;
+			}
+			return true;
+		}
+
+		// Shortcuts used by the handlers.
+		//
+#define OPR(i) interpreter::read( state, ins, ins.operands[ i ] )
+#define SET(i, v) interpreter::write( state, ins.operands[ i ], v )
+#define HANDLER(name) static control name( const interpreter& vm, interpreter_state& state, const decoded_instruction& ins, uint64_t& target )
+
+		// Data and memory instructions.
+		//
+		HANDLER( h_mov ) { SET( 0, OPR( 1 ) ); return control::next; }
+		HANDLER( h_str )
+		{
+			state.memory.write( interpreter::address( state, ins.operands[ 0 ], ins.operands[ 1 ] ), OPR( 2 ), byte_count_of( ins.bit_count ) );
+			return control::next;
+		}
+		HANDLER( h_ldd )
+		{
+			SET( 0, state.memory.read( interpreter::address( state, ins.operands[ 1 ], ins.operands[ 2 ] ), byte_count_of( ins.bit_count ) ) );
+			return control::next;
+		}
+
+		// Arithmetic instructions.
+		//
+		HANDLER( h_neg ) { SET( 0, 0 - OPR( 0 ) ); return control::next; }
+		HANDLER( h_add ) { SET( 0, OPR( 0 ) + OPR( 1 ) ); return control::next; }
+		HANDLER( h_sub ) { SET( 0, OPR( 0 ) - OPR( 1 ) ); return control::next; }
+		HANDLER( h_mul ) { SET( 0, OPR( 0 ) * OPR( 1 ) ); return control::next; }
+		HANDLER( h_mulhi )
+		{
+			uint64_t hi, lo = umul128( OPR( 0 ), OPR( 1 ), &hi );
+			SET( 0, ins.bit_count >= 64 ? hi : ( lo >> ins.bit_count ) | ( hi << ( 64 - ins.bit_count ) ) );
+			return control::next;
+		}
+		HANDLER( h_imulhi )
+		{
+			int64_t hi;
+			uint64_t lo = mul128( sign_extend( OPR( 0 ), ins.bit_count ), sign_extend( OPR( 1 ), ins.bit_count ), &hi );
+			SET( 0, ins.bit_count >= 64 ? uint64_t( hi ) : ( lo >> ins.bit_count ) | ( uint64_t( hi ) << ( 64 - ins.bit_count ) ) );
+			return control::next;
+		}
+		template<bool is_signed, bool is_remainder>
+		HANDLER( h_div )
+		{
+			uint64_t q, r;
+			if ( !divide( OPR( 1 ), OPR( 0 ), OPR( 2 ), ins.bit_count, is_signed, q, r ) )
+				return control::fault;
+			SET( 0, is_remainder ? r : q );
+			return control::next;
+		}
+
+		// Bitwise instructions.
+		//
+		HANDLER( h_not ) { SET( 0, ~OPR( 0 ) ); return control::next; }
+		HANDLER( h_shr ) { uint64_t n = OPR( 1 ); SET( 0, n >= ins.bit_count ? 0 : OPR( 0 ) >> n ); return control::next; }
+		HANDLER( h_shl ) { uint64_t n = OPR( 1 ); SET( 0, n >= ins.bit_count ? 0 : OPR( 0 ) << n ); return control::next; }
+		HANDLER( h_xor ) { SET( 0, OPR( 0 ) ^ OPR( 1 ) ); return control::next; }
+		HANDLER( h_or ) { SET( 0, OPR( 0 ) | OPR( 1 ) ); return control::next; }
+		HANDLER( h_and ) { SET( 0, OPR( 0 ) & OPR( 1 ) ); return control::next; }
+		HANDLER( h_ror )
+		{
+			uint64_t v = OPR( 0 ), n = OPR( 1 ) % ins.bit_count;
+			SET( 0, n ? ( v >> n ) | ( v << ( ins.bit_count - n ) ) : v );
+			return control::next;
+		}
+		HANDLER( h_rol )
+		{
+			uint64_t v = OPR( 0 ), n = OPR( 1 ) % ins.bit_count;
+			SET( 0, n ? ( v << n ) | ( v >> ( ins.bit_count - n ) ) : v );
+			return control::next;
+		}
+
+		// Control flow instructions.
+		//
+		HANDLER( h_js ) { target = OPR( 0 ) ? OPR( 2 ) : OPR( 1 ); return control::branch; }
+		HANDLER( h_jmp ) { target = OPR( 0 ); return control::branch; }
+		HANDLER( h_vexit ) { target = OPR( 0 ); return control::exit; }
+		HANDLER( h_vxcall ) 
+		{ 
+			if ( vm.vxcall_hook ) 
+				vm.vxcall_hook( state, OPR( 0 ) ); 
+			return control::next; 
+		}
+
+		// Special instructions.
+		//
+		HANDLER( h_nop ) { return control::next; }
+		HANDLER( h_vsetcc ) 
+		{ 
+			SET( 0, ( state.registers[ vm.flags_slot ] >> ins.operands[ 1 ].immediate ) & 1 ); 
+			return control::next; 
+		}
+		HANDLER( h_vemit ) 
+		{ 
+			if ( vm.vemit_hook ) 
+				vm.vemit_hook( state, ins.operands[ 0 ].immediate ); 
+			return control::next; 
+		}
+		HANDLER( h_invalid ) { return control::fault; }
+
+#undef OPR
+#undef SET
+#undef HANDLER
+
+		// Handlers indexed by opcode, the operands of the instruction are already 
+		// truncated to their size on read and write so the handlers only have to 
+		// consider the size for operations that depend on it.
+		//
+		static constexpr interpreter::handler_type handler_table[] =
+		{
+			/*mov*/    h_mov,    /*movr*/   h_mov,    /*str*/    h_str,    /*ldd*/    h_ldd,
+			/*neg*/    h_neg,    /*add*/    h_add,    /*sub*/    h_sub,    /*mul*/    h_mul,
+			/*imul*/   h_mul,    /*mulhi*/  h_mulhi,  /*imulhi*/ h_imulhi, /*div*/    h_div<false, false>,
+			/*idiv*/   h_div<true, false>,  /*rem*/    h_div<false, true>,  /*irem*/   h_div<true, true>,
+			/*not*/    h_not,    /*shr*/    h_shr,    /*shl*/    h_shl,    /*xor*/    h_xor,
+			/*or*/     h_or,     /*and*/    h_and,    /*ror*/    h_ror,    /*rol*/    h_rol,
+			/*js*/     h_js,     /*jmp*/    h_jmp,    /*vexit*/  h_vexit,  /*vxcall*/ h_vxcall,
+			/*nop*/    h_nop,    /*upflg*/  h_nop,    /*vsetcc*/ h_vsetcc, /*vemit*/  h_vemit,
+			/*vpinr*/  h_nop,    /*vpinw*/  h_nop,    /*vpinrm*/ h_nop,    /*vpinwm*/ h_nop,
+		};
+		static_assert( std::size( handler_table ) == std::size( instruction_list ), "Handler table does not cover every instruction." );
+	};
+
+	// Returns the slot of the register, assigning one if it does not have one.
+	//
+	uint32_t interpreter::assign_slot( const register_desc& reg )
+	{
+		auto [it, inserted] = slot_of.try_emplace( reg.key(), slot_count );
+		if ( inserted ) 
+			slot_count++;
+		return it->second;
+	}
+
+	// Decodes a single operand.
+	//
+	interpreter::decoded_operand interpreter::decode( const operand& op )
+	{
+		decoded_operand out;
+		if ( op.is_register() )
+		{
+			out.is_register = true;
+			out.slot = assign_slot( op.reg );
+			out.shift = op.reg.bit_offset;
+			out.bit_count = op.reg.bit_count;
+			out.mask = impl::mask_of( op.reg.bit_count );
+			out.is_stack_pointer = op.reg.is_stack_pointer();
+		}
+		else if ( op.is_immediate() )
+		{
+			out.bit_count = op.imm.bit_count;
+			out.mask = impl::mask_of( op.imm.bit_count );
+			out.immediate = op.imm.u64 & out.mask;
+		}
+		return out;
+	}
+
+	// Decodes the block, assigning slots to the registers that were not seen before.
+	//
+	std::unique_ptr<interpreter::decoded_block> interpreter::decode_block( const basic_block* block )
+	{
+		auto dblk = std::make_unique<decoded_block>();
+		dblk->block = block;
+		dblk->sp_offset = block->sp_offset;
+		dblk->code.reserve( block->size() );
+		for ( auto it = block->stream.begin(); it != block->stream.end(); ++it )
+		{
+			// Decode the instruction with the queued stack shifts applied, the source is only 
+			// referred to for its VIP and descriptor which are not affected by them.
+			//
+			instruction ins = block->stream.resolve( it );
+			decoded_instruction& dins = dblk->code.emplace_back();
+			dins.handler = ins.base->opcode < std::size( impl::handler_table ) ? impl::handler_table[ ins.base->opcode ] : impl::h_invalid;
+			dins.sp_offset = ins.sp_offset;
+			dins.source = &*it;
+			dins.bit_count = 0;
+			if ( !ins.operands.empty() )
+			{
+				const operand& sized = ins.operands[ ins.base->access_size_index ];
+				dins.bit_count = sized.is_register() ? sized.reg.bit_count : sized.imm.bit_count;
+			}
+			for ( size_t i = 0; i != ins.operands.size(); i++ )
+				dins.operands[ i ] = decode( ins.operands[ i ] );
+		}
+		return dblk;
+	}
+
+	// Decodes the routine.
+	//
+	interpreter::interpreter( const routine* rtn ) : rtn( rtn )
+	{
+		// Assign the first slots to the stack pointer and the flags.
+		//
+		sp_slot = assign_slot( REG_SP );
+		flags_slot = assign_slot( REG_FLAGS );
+
+		// Decode every block.
+		//
+		rtn->materialize_all();
+		blocks.resize( rtn->next_block_index );
+		for ( auto& [vip, block] : rtn->explored_blocks )
+			blocks[ block->index ] = decode_block( block );
+
+		// Resolve the successors.
+		//
+		for ( auto& dblk : blocks )
+		{
+			if ( !dblk ) continue;
+			for ( basic_block* dst : dblk->block->next )
+				dblk->successors.push_back( { dst->entry_vip, blocks[ dst->index ].get() } );
+		}
+	}
+
+	// Reads and writes registers in the state.
+	//
+	uint64_t interpreter::read_register( const interpreter_state& state, const register_desc& reg ) const
+	{
+		auto it = slot_of.find( reg.key() );
+		if ( it == slot_of.end() || it->second >= state.registers.size() )
+			return 0;
+		return ( state.registers[ it->second ] >> reg.bit_offset ) & impl::mask_of( reg.bit_count );
+	}
+	void interpreter::write_register( interpreter_state& state, const register_desc& reg, uint64_t value ) const
+	{
+		auto it = slot_of.find( reg.key() );
+		if ( it == slot_of.end() || it->second >= state.registers.size() )
+			return;
+		uint64_t mask = impl::mask_of( reg.bit_count ) << reg.bit_offset;
+		uint64_t& slot = state.registers[ it->second ];
+		slot = ( slot & ~mask ) | ( ( value << reg.bit_offset ) & mask );
+	}
+
+	// Executes the routine starting from the block until it exits or the instruction limit is hit.
+	//
+	interpreter_exit interpreter::run( interpreter_state& state, const basic_block* entry, uint64_t instruction_limit ) const
+	{
+		const decoded_block* blk = decoded( entry );
+		fassert( blk );
+
+		uint64_t limit = state.instruction_count + instruction_limit;
+		if ( limit < state.instruction_count )
+			limit = ~0ull;
+
+		while ( true )
+		{
+			// Execute the block.
+			//
+			uint64_t target = 0;
+			control result = control::next;
+			const decoded_instruction* it = blk->code.data();
+			const decoded_instruction* end = it + blk->code.size();
+			for ( ; it != end; ++it )
+			{
+				if ( state.instruction_count == limit )
+					return { exit_reason::instruction_limit, it->source->vip, blk->block };
+				state.instruction_count++;
+
+				result = it->handler( *this, state, *it, target );
+				if ( result != control::next )
+					break;
+			}
+
+			// Handle the control flow.
+			//
+			switch ( result )
+			{
+				case control::fault:
+					return { exit_reason::fault, it->source->vip, blk->block };
+				case control::exit:
+					state.registers[ sp_slot ] += blk->sp_offset;
+					return { exit_reason::vexit, target, blk->block };
+				case control::branch:
+				{
+					state.registers[ sp_slot ] += blk->sp_offset;
+
+					// Look up the destination among the successors and fallback to the explored blocks.
+					//
+					const decoded_block* next = nullptr;
+					for ( auto& [vip, dst] : blk->successors )
+					{
+						if ( vip == target )
+						{
+							next = dst;
+							break;
+						}
+					}
+					if ( !next )
+					{
+						const basic_block* dst = rtn->explored_blocks.find( target );
+						next = dst ? decoded( dst ) : nullptr;
+					}
+					if ( !next )
+						return { exit_reason::unexplored_block, target, blk->block };
+					blk = next;
+					break;
+				}
+				default:
+					// Block ended without a branch, which can only happen if it is incomplete.
+					//
+					return { exit_reason::unexplored_block, invalid_vip, blk->block };
+			}
+		}
+	}
+};
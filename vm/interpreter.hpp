@@ -0,0 +1,240 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "..\routine\basic_block.hpp"
+#include "..\arch\register_map.hpp"
+
+namespace vtil
+{
+	// Sparse memory model used by the interpreter, memory is split into pages
+	// allocated on the first write, reads from pages never written yield zero.
+	//
+	struct sparse_memory
+	{
+		static constexpr size_t page_bits = 12;
+		static constexpr size_t page_size = 1ull << page_bits;
+
+		// Pages allocated and the page last accessed.
+		//
+		std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> pages;
+		uint64_t cached_page_index = ~0ull;
+		uint8_t* cached_page = nullptr;
+
+		// Reads and writes the value with the given byte count in little-endian order.
+		//
+		uint64_t read( uint64_t address, size_t byte_count );
+		void write( uint64_t address, uint64_t value, size_t byte_count );
+
+		// Returns the page the address belongs to, allocating it if requested.
+		//
+		uint8_t* page_of( uint64_t address, bool allocate );
+	};
+
+	// Execution state of a routine, holding the register file and the memory.
+	//
+	struct interpreter_state
+	{
+		// Values of the registers indexed by the slots the interpreter assigned.
+		//
+		std::vector<uint64_t> registers;
+
+		// Memory accessed via STR and LDD.
+		//
+		sparse_memory memory;
+
+		// Number of instructions executed.
+		//
+		uint64_t instruction_count = 0;
+	};
+
+	// Reasons the execution of a routine may end with.
+	//
+	enum class exit_reason
+	{
+		// Routine exited via VEXIT, target is the exit destination.
+		//
+		vexit,
+
+		// Routine branched to a VIP that is not explored, target is the VIP.
+		//
+		unexplored_block,
+
+		// Instruction faulted due to a division error or an unknown opcode, target is the VIP of the instruction.
+		//
+		fault,
+
+		// Instruction limit was hit.
+		//
+		instruction_limit,
+	};
+
+	// Result of the execution.
+	//
+	struct interpreter_exit
+	{
+		exit_reason reason;
+		uint64_t target;
+		const basic_block* block;
+	};
+
+	// Interpreter for VTIL routines. Each block is pre-decoded into a compact array of instructions with the 
+	// handler resolved from a table indexed by opcode, and each register is resolved to a slot in a flat 
+	// register file, so that the execution itself does no lookups other than the branch destinations.
+	// - Routine is decoded once on construction, so it must not be modified while the interpreter is used. 
+	//   Multiple states can be executed in parallel as the interpreter itself is not modified.
+	// - Reads of the stack pointer are adjusted by the queued stack pointer offset of the instruction and
+	//   the queued offset of the block is applied to it when the block branches, except when it is the 
+	//   base of a memory operand whose displacement already includes the offset.
+	// - Writes to a part of a register preserve the rest of it.
+	//
+	struct interpreter
+	{
+		// Operand and instruction after decoding.
+		//
+		struct decoded_operand
+		{
+			uint64_t immediate = 0;
+			uint64_t mask = 0;
+			uint32_t slot = 0;
+			uint8_t shift = 0;
+			uint8_t bit_count = 0;
+			bool is_register = false;
+			bool is_stack_pointer = false;
+		};
+		struct decoded_instruction;
+		enum class control : uint8_t { next, branch, exit, fault };
+		using handler_type = control( * )( const interpreter&, interpreter_state&, const decoded_instruction&, uint64_t& target );
+		struct decoded_instruction
+		{
+			handler_type handler;
+			int64_t sp_offset;
+			bitcnt_t bit_count;
+			const instruction* source;
+			decoded_operand operands[ max_operand_count ];
+		};
+		struct decoded_block
+		{
+			const basic_block* block;
+			int64_t sp_offset;
+			std::vector<decoded_instruction> code;
+			std::vector<std::pair<vip_t, const decoded_block*>> successors;
+		};
+
+		// Routine interpreted.
+		//
+		const routine* rtn;
+
+		// Slot assigned to each register.
+		//
+		register_map<uint32_t> slot_of;
+		uint32_t slot_count = 0;
+		uint32_t sp_slot;
+		uint32_t flags_slot;
+
+		// Decoded blocks indexed by the block index.
+		//
+		std::vector<std::unique_ptr<decoded_block>> blocks;
+
+		// Hooks invoked for VXCALL with the call destination and VEMIT with the emitted immediate.
+		//
+		std::function<void( interpreter_state&, uint64_t )> vxcall_hook;
+		std::function<void( interpreter_state&, uint64_t )> vemit_hook;
+
+		// Decodes the routine.
+		//
+		interpreter( const routine* rtn );
+
+		// Creates a state with every register and the memory zeroed.
+		//
+		interpreter_state create_state() const { return { std::vector<uint64_t>( slot_count, 0 ) }; }
+
+		// Reads and writes registers in the state, registers the routine does not access or the state
+		// has no slot for read as zero and writes to them are ignored.
+		//
+		uint64_t read_register( const interpreter_state& state, const register_desc& reg ) const;
+		void write_register( interpreter_state& state, const register_desc& reg, uint64_t value ) const;
+
+		// Executes the routine starting from the block until it exits or the instruction limit is hit.
+		//
+		interpreter_exit run( interpreter_state& state, const basic_block* entry, uint64_t instruction_limit = ~0ull ) const;
+		interpreter_exit run( interpreter_state& state, uint64_t instruction_limit = ~0ull ) const { return run( state, rtn->entry_point, instruction_limit ); }
+
+		// Returns the decoded block, or nullptr if the block does not belong to the routine.
+		//
+		const decoded_block* decoded( const basic_block* blk ) const { return blk->index < blocks.size() ? blocks[ blk->index ].get() : nullptr; }
+
+		// Decodes the block, assigning slots to the registers that were not seen before.
+		// - States executed after new slots were assigned must be resized accordingly.
+		//
+		std::unique_ptr<decoded_block> decode_block( const basic_block* blk );
+
+		// Executes a single decoded instruction, exposed for the compiled code to fall back to.
+		//
+		static control execute( const interpreter& vm, interpreter_state& state, const decoded_instruction& ins, uint64_t& target ) { return ins.handler( vm, state, ins, target ); }
+
+		// Operand accessors used by the handlers.
+		//
+		static uint64_t read( const interpreter_state& state, const decoded_instruction& ins, const decoded_operand& op )
+		{
+			if ( !op.is_register )
+				return op.immediate;
+			uint64_t value = state.registers[ op.slot ];
+			if ( op.is_stack_pointer )
+				value += ins.sp_offset;
+			return ( value >> op.shift ) & op.mask;
+		}
+		// Computes the address of a memory operand. The displacement already accounts for the queued 
+		// stack pointer offset so the base is read as is, and it is sign-extended as it may be narrower.
+		//
+		static uint64_t address( const interpreter_state& state, const decoded_operand& base, const decoded_operand& offset )
+		{
+			uint64_t displacement = offset.immediate;
+			if ( offset.bit_count && offset.bit_count < 64 )
+				displacement = uint64_t( int64_t( displacement << ( 64 - offset.bit_count ) ) >> ( 64 - offset.bit_count ) );
+			return ( ( state.registers[ base.slot ] >> base.shift ) & base.mask ) + displacement;
+		}
+		static void write( interpreter_state& state, const decoded_operand& op, uint64_t value )
+		{
+			uint64_t& reg = state.registers[ op.slot ];
+			reg = ( reg & ~( op.mask << op.shift ) ) | ( ( value & op.mask ) << op.shift );
+		}
+
+	private:
+		// Returns the slot of the register, assigning one if it does not have one.
+		//
+		uint32_t assign_slot( const register_desc& reg );
+
+		// Decodes a single operand.
+		//
+		decoded_operand decode( const operand& op );
+	};
+};
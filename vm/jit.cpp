@@ -0,0 +1,551 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#include "jit.hpp"
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace vtil
+{
+	// Copies the code into executable memory, returns nullptr if the memory could not be allocated.
+	//
+	void* jit_code_heap::allocate( const uint8_t* code, size_t length )
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo( &info );
+		size_t page_size = info.dwPageSize;
+#else
+		size_t page_size = ( size_t ) sysconf( _SC_PAGESIZE );
+#endif
+
+		// Pick a chunk with enough space, allocate a new one if there is none.
+		//
+		chunk* target = nullptr;
+		if ( !chunks.empty() && ( chunks.back().size - chunks.back().used ) >= length )
+			target = &chunks.back();
+		if ( !target )
+		{
+			size_t size = std::max( chunk_size, ( length + page_size - 1 ) & ~( page_size - 1 ) );
+#ifdef _WIN32
+			void* base = VirtualAlloc( nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READ );
+			if ( !base ) return nullptr;
+#else
+			void* base = mmap( nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+			if ( base == MAP_FAILED ) return nullptr;
+#endif
+			target = &chunks.emplace_back( chunk{ ( uint8_t* ) base, size, 0 } );
+		}
+
+		// Make the pages spanned writable, copy the code and make them executable again.
+		//
+		uint8_t* out = target->base + target->used;
+		uint8_t* page_begin = target->base + ( target->used & ~( page_size - 1 ) );
+		size_t page_length = ( ( target->used + length + page_size - 1 ) & ~( page_size - 1 ) ) - ( target->used & ~( page_size - 1 ) );
+#ifdef _WIN32
+		DWORD old_protect;
+		if ( !VirtualProtect( page_begin, page_length, PAGE_READWRITE, &old_protect ) )
+			return nullptr;
+		memcpy( out, code, length );
+		VirtualProtect( page_begin, page_length, PAGE_EXECUTE_READ, &old_protect );
+		FlushInstructionCache( GetCurrentProcess(), out, length );
+#else
+		if ( mprotect( page_begin, page_length, PROT_READ | PROT_WRITE ) )
+			return nullptr;
+		memcpy( out, code, length );
+		mprotect( page_begin, page_length, PROT_READ | PROT_EXEC );
+#endif
+
+		// Keep the next entry aligned.
+		//
+		target->used = std::min( target->size, ( target->used + length + 15 ) & ~size_t( 15 ) );
+		return out;
+	}
+
+	// Releases all of the memory.
+	//
+	void jit_code_heap::reset()
+	{
+		for ( chunk& c : chunks )
+		{
+#ifdef _WIN32
+			VirtualFree( c.base, 0, MEM_RELEASE );
+#else
+			munmap( c.base, c.size );
+#endif
+		}
+		chunks.clear();
+	}
+
+	namespace impl
+	{
+		using control = interpreter::control;
+		using decoded_instruction = interpreter::decoded_instruction;
+		using decoded_operand = interpreter::decoded_operand;
+
+		static size_t byte_count_of( bitcnt_t n ) { return n == 1 ? 1 : n / 8; }
+
+		// Helpers the compiled code calls for the instructions it does not emit natively,
+		// the instruction is recorded in the context if it ends the block.
+		//
+		static control call_handler( jit::context* ctx, const decoded_instruction* ins )
+		{
+			control result = ins->handler( ctx->owner->vm, *ctx->state, *ins, ctx->target );
+			if ( result != control::next )
+				ctx->last = ins;
+			return result;
+		}
+		static control call_load( jit::context* ctx, const decoded_instruction* ins )
+		{
+			uint64_t address = interpreter::address( *ctx->state, ins->operands[ 1 ], ins->operands[ 2 ] );
+			uint64_t value;
+			if ( !ctx->owner->load( *ctx->state, address, byte_count_of( ins->bit_count ), value ) )
+			{
+				ctx->last = ins;
+				return control::fault;
+			}
+			interpreter::write( *ctx->state, ins->operands[ 0 ], value );
+			return control::next;
+		}
+		static control call_store( jit::context* ctx, const decoded_instruction* ins )
+		{
+			uint64_t address = interpreter::address( *ctx->state, ins->operands[ 0 ], ins->operands[ 1 ] );
+			if ( !ctx->owner->store( *ctx->state, address, interpreter::read( *ctx->state, *ins, ins->operands[ 2 ] ), byte_count_of( ins->bit_count ) ) )
+			{
+				ctx->last = ins;
+				return control::fault;
+			}
+			return control::next;
+		}
+
+		// Executes the block via the helpers only.
+		//
+		static control execute_helpers( jit::context* ctx, const jit::compiled_block* blk )
+		{
+			const decoded_instruction* code = blk->decoded->code.data();
+			for ( size_t i = 0; i != blk->helpers.size(); i++ )
+			{
+				control result = blk->helpers[ i ]( ctx, code + i );
+				if ( result != control::next )
+					return result;
+			}
+			return control::next;
+		}
+
+#if defined(_M_X64) || defined(__x86_64__)
+		// Minimal x86-64 assembler covering the instructions the compiler emits, the compiled 
+		// code keeps the register file in RBX and the context in R12 and uses RAX and RCX as 
+		// scratch registers.
+		//
+		struct assembler
+		{
+			enum gpr : uint8_t { rax = 0, rcx = 1 };
+			std::vector<uint8_t> bytes;
+
+			void emit( std::initializer_list<uint8_t> list ) { bytes.insert( bytes.end(), list ); }
+			void emit_imm32( uint32_t v ) { for ( int i = 0; i != 4; i++ ) bytes.push_back( uint8_t( v >> ( i * 8 ) ) ); }
+			void emit_imm64( uint64_t v ) { for ( int i = 0; i != 8; i++ ) bytes.push_back( uint8_t( v >> ( i * 8 ) ) ); }
+			static bool is_imm32( uint64_t v ) { return int64_t( v ) == int32_t( v ); }
+
+			// [RBX + disp] addressing of the register file.
+			//
+			void emit_slot( uint8_t opcode, gpr r, uint32_t slot )
+			{
+				uint32_t disp = slot * 8;
+				if ( disp < 0x80 ) emit( { 0x48, opcode, uint8_t( 0x43 | ( r << 3 ) ), uint8_t( disp ) } );
+				else emit( { 0x48, opcode, uint8_t( 0x83 | ( r << 3 ) ) } ), emit_imm32( disp );
+			}
+			void load_slot( gpr r, uint32_t slot ) { emit_slot( 0x8B, r, slot ); }
+			void store_slot( gpr r, uint32_t slot ) { emit_slot( 0x89, r, slot ); }
+
+			// MOV r, imm.
+			//
+			void load_imm( gpr r, uint64_t v )
+			{
+				if ( !v ) emit( { 0x31, uint8_t( 0xC0 | ( r << 3 ) | r ) } );
+				else if ( is_imm32( v ) ) emit( { 0x48, 0xC7, uint8_t( 0xC0 | r ) } ), emit_imm32( uint32_t( v ) );
+				else emit( { 0x48, uint8_t( 0xB8 | r ) } ), emit_imm64( v );
+			}
+
+			// <op> RAX, RCX and <op> RAX, imm32 for the ALU group, indexed by the /digit.
+			//
+			void alu_rcx( uint8_t digit ) { emit( { 0x48, uint8_t( digit * 8 + 1 ), 0xC8 } ); }
+			void alu_imm( uint8_t digit, uint32_t v, gpr r = rax ) { emit( { 0x48, 0x81, uint8_t( 0xC0 | ( digit << 3 ) | r ) } ), emit_imm32( v ); }
+		};
+
+		// Operand checks for the native forms, which only cover whole 64-bit registers and immediates.
+		//
+		static bool is_native_operand( const decoded_instruction& dins, const decoded_operand& op )
+		{
+			if ( !op.is_register )
+				return true;
+			if ( op.shift != 0 || op.bit_count != 64 )
+				return false;
+			return !op.is_stack_pointer || assembler::is_imm32( dins.sp_offset );
+		}
+		static bool is_native_destination( const decoded_operand& op )
+		{
+			return op.is_register && op.shift == 0 && op.bit_count == 64;
+		}
+
+		// Loads the operand into the scratch register.
+		//
+		static void load_operand( assembler& as, assembler::gpr r, const decoded_instruction& dins, const decoded_operand& op )
+		{
+			if ( !op.is_register )
+				return as.load_imm( r, op.immediate );
+			as.load_slot( r, op.slot );
+			if ( op.is_stack_pointer && dins.sp_offset )
+				as.alu_imm( 0, uint32_t( dins.sp_offset ), r );
+		}
+
+		// Emits the instruction natively if possible, returns false otherwise.
+		//
+		static bool emit_native( assembler& as, const decoded_instruction& dins )
+		{
+			if ( dins.bit_count != 64 )
+				return false;
+
+			const instruction_desc* base = dins.source->base;
+			const decoded_operand* ops = dins.operands;
+
+			// MOV and MOVR.
+			//
+			if ( base == &ins::mov || base == &ins::movr )
+			{
+				if ( !is_native_destination( ops[ 0 ] ) || !is_native_operand( dins, ops[ 1 ] ) )
+					return false;
+				load_operand( as, assembler::rax, dins, ops[ 1 ] );
+				as.store_slot( assembler::rax, ops[ 0 ].slot );
+				return true;
+			}
+
+			// Unary operations.
+			//
+			if ( base == &ins::neg || base == &ins::bnot )
+			{
+				if ( !is_native_destination( ops[ 0 ] ) || ops[ 0 ].is_stack_pointer )
+					return false;
+				as.load_slot( assembler::rax, ops[ 0 ].slot );
+				as.emit( { 0x48, 0xF7, uint8_t( base == &ins::neg ? 0xD8 : 0xD0 ) } );
+				as.store_slot( assembler::rax, ops[ 0 ].slot );
+				return true;
+			}
+
+			// Shifts by an immediate below the bit count, others are left to the handler.
+			//
+			if ( base == &ins::bshl || base == &ins::bshr )
+			{
+				if ( !is_native_destination( ops[ 0 ] ) || ops[ 0 ].is_stack_pointer || ops[ 1 ].is_register || ops[ 1 ].immediate >= 64 )
+					return false;
+				as.load_slot( assembler::rax, ops[ 0 ].slot );
+				as.emit( { 0x48, 0xC1, uint8_t( base == &ins::bshl ? 0xE0 : 0xE8 ), uint8_t( ops[ 1 ].immediate ) } );
+				as.store_slot( assembler::rax, ops[ 0 ].slot );
+				return true;
+			}
+
+			// Binary operations, /digit of the ALU group or ~0 for multiplication.
+			//
+			uint8_t digit;
+			if ( base == &ins::add )                            digit = 0;
+			else if ( base == &ins::bor )                       digit = 1;
+			else if ( base == &ins::band )                      digit = 4;
+			else if ( base == &ins::sub )                       digit = 5;
+			else if ( base == &ins::bxor )                      digit = 6;
+			else if ( base == &ins::mul || base == &ins::imul ) digit = 0xFF;
+			else                                                return false;
+
+			if ( !is_native_destination( ops[ 0 ] ) || ops[ 0 ].is_stack_pointer || !is_native_operand( dins, ops[ 1 ] ) )
+				return false;
+
+			as.load_slot( assembler::rax, ops[ 0 ].slot );
+			if ( digit != 0xFF && !ops[ 1 ].is_register && assembler::is_imm32( ops[ 1 ].immediate ) )
+			{
+				as.alu_imm( digit, uint32_t( ops[ 1 ].immediate ) );
+			}
+			else
+			{
+				load_operand( as, assembler::rcx, dins, ops[ 1 ] );
+				if ( digit == 0xFF ) as.emit( { 0x48, 0x0F, 0xAF, 0xC1 } );
+				else                 as.alu_rcx( digit );
+			}
+			as.store_slot( assembler::rax, ops[ 0 ].slot );
+			return true;
+		}
+
+		// Compiles the block, returning the code bytes.
+		//
+		static std::vector<uint8_t> compile_block( jit::compiled_block* blk )
+		{
+			assembler as;
+			std::vector<size_t> exit_fixups;
+
+			// Prologue: save RBX and R12, align the stack leaving room for the shadow space, 
+			// and load the context and the register file.
+			//
+			as.emit( { 0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x28 } );
+#ifdef _WIN32
+			as.emit( { 0x49, 0x89, 0xCC } );
+#else
+			as.emit( { 0x49, 0x89, 0xFC } );
+#endif
+			as.emit( { 0x49, 0x8B, 0x1C, 0x24 } );
+
+			const auto& code = blk->decoded->code;
+			for ( size_t i = 0; i != code.size(); i++ )
+			{
+				if ( blk->helpers[ i ] == &call_handler && emit_native( as, code[ i ] ) )
+				{
+					blk->native_count++;
+					continue;
+				}
+
+				// Call the helper with the context and the instruction, leave if it did not return control::next.
+				//
+#ifdef _WIN32
+				as.emit( { 0x4C, 0x89, 0xE1, 0x48, 0xBA } );
+#else
+				as.emit( { 0x4C, 0x89, 0xE7, 0x48, 0xBE } );
+#endif
+				as.emit_imm64( ( uint64_t ) &code[ i ] );
+				as.emit( { 0x48, 0xB8 } );
+				as.emit_imm64( ( uint64_t ) blk->helpers[ i ] );
+				as.emit( { 0xFF, 0xD0, 0x84, 0xC0, 0x0F, 0x85 } );
+				exit_fixups.push_back( as.bytes.size() );
+				as.emit_imm32( 0 );
+			}
+
+			// Block ended without leaving, return control::next.
+			//
+			as.emit( { 0x31, 0xC0 } );
+
+			// Epilogue.
+			//
+			size_t epilogue = as.bytes.size();
+			for ( size_t fixup : exit_fixups )
+			{
+				uint32_t rel = uint32_t( epilogue - ( fixup + 4 ) );
+				memcpy( as.bytes.data() + fixup, &rel, 4 );
+			}
+			as.emit( { 0x48, 0x83, 0xC4, 0x28, 0x41, 0x5C, 0x5B, 0xC3 } );
+			return std::move( as.bytes );
+		}
+#endif
+	};
+
+	// Returns whether or not native code can be generated for the target.
+	//
+	bool jit::is_supported()
+	{
+#if defined(_M_X64) || defined(__x86_64__)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Accesses the memory on behalf of the compiled code, returns false if the access faults.
+	//
+	bool jit::load( interpreter_state& state, uint64_t address, size_t byte_count, uint64_t& value )
+	{
+		if ( memory.buffer )
+		{
+			uint64_t offset = address - memory.base;
+			if ( offset > memory.size || ( memory.size - offset ) < byte_count )
+				return false;
+			value = 0;
+			for ( size_t i = 0; i != byte_count; i++ )
+				value |= uint64_t( memory.buffer[ offset + i ] ) << ( i * 8 );
+			return true;
+		}
+		value = memory.read ? memory.read( address, byte_count ) : state.memory.read( address, byte_count );
+		return true;
+	}
+	bool jit::store( interpreter_state& state, uint64_t address, uint64_t value, size_t byte_count )
+	{
+		if ( memory.buffer )
+		{
+			uint64_t offset = address - memory.base;
+			if ( offset > memory.size || ( memory.size - offset ) < byte_count )
+				return false;
+			for ( size_t i = 0; i != byte_count; i++ )
+				memory.buffer[ offset + i ] = uint8_t( value >> ( i * 8 ) );
+			return true;
+		}
+		if ( memory.write ) memory.write( address, value, byte_count );
+		else                state.memory.write( address, value, byte_count );
+		return true;
+	}
+
+	// Compiles the block into the entry.
+	//
+	void jit::build( compiled_block* out, const basic_block* blk )
+	{
+		out->block = blk;
+		out->edit_epoch = blk->stream.edit_epoch;
+		out->length = blk->size();
+		out->sp_offset = blk->sp_offset;
+		out->is_valid = true;
+		out->decoded = vm.decode_block( blk );
+		out->shift_epoch = blk->stream.shift_epoch;
+		out->entry = nullptr;
+		out->native_count = 0;
+		out->successors.clear();
+		compile_count++;
+
+		// Pick the helper of each instruction.
+		//
+		out->helpers.clear();
+		for ( auto& dins : out->decoded->code )
+		{
+			if ( dins.source->base == &ins::ldd )      out->helpers.push_back( &impl::call_load );
+			else if ( dins.source->base == &ins::str ) out->helpers.push_back( &impl::call_store );
+			else                                      out->helpers.push_back( &impl::call_handler );
+		}
+
+		// Generate the native code.
+		//
+#if defined(_M_X64) || defined(__x86_64__)
+		std::vector<uint8_t> code = impl::compile_block( out );
+		out->entry = ( entry_type ) code_heap.allocate( code.data(), code.size() );
+#endif
+	}
+
+	// Returns the compiled block, compiling it if it is not in the cache or is out of date.
+	//
+	jit::compiled_block* jit::compile( const basic_block* blk )
+	{
+		auto& entry = cache[ blk->entry_vip ];
+		if ( !entry )
+			entry = std::make_unique<compiled_block>();
+
+		if ( entry->block != blk || !entry->is_current() )
+			build( entry.get(), blk );
+		return entry.get();
+	}
+
+	// Marks the block at the VIP for recompilation.
+	//
+	void jit::invalidate( vip_t vip )
+	{
+		auto it = cache.find( vip );
+		if ( it != cache.end() )
+			it->second->is_valid = false;
+	}
+
+	// Drops every compiled block.
+	//
+	void jit::flush()
+	{
+		cache.clear();
+		code_heap.reset();
+	}
+
+	// Executes the routine starting from the block until it exits or the instruction limit is hit.
+	//
+	interpreter_exit jit::run( interpreter_state& state, const basic_block* entry, uint64_t instruction_limit )
+	{
+		using control = interpreter::control;
+
+		uint64_t limit = state.instruction_count + instruction_limit;
+		if ( limit < state.instruction_count )
+			limit = ~0ull;
+
+		context ctx = { nullptr, this, &state, 0, nullptr };
+		compiled_block* blk = compile( entry );
+		while ( true )
+		{
+			// Stop before the block if it would exceed the limit.
+			//
+			const auto& code = blk->decoded->code;
+			if ( ( limit - state.instruction_count ) < code.size() )
+				return { exit_reason::instruction_limit, code[ limit - state.instruction_count ].source->vip, blk->block };
+
+			// Grow the register file if the compilation assigned new slots and execute the block.
+			//
+			if ( state.registers.size() < vm.slot_count )
+				state.registers.resize( vm.slot_count, 0 );
+			ctx.registers = state.registers.data();
+			ctx.last = nullptr;
+			control result = blk->entry ? blk->entry( &ctx ) : impl::execute_helpers( &ctx, blk );
+			state.instruction_count += ctx.last ? ( ctx.last - code.data() ) + 1 : code.size();
+
+			// Handle the control flow.
+			//
+			switch ( result )
+			{
+				case control::fault:
+					return { exit_reason::fault, ctx.last->source->vip, blk->block };
+				case control::exit:
+					state.registers[ vm.sp_slot ] += blk->sp_offset;
+					return { exit_reason::vexit, ctx.target, blk->block };
+				case control::branch:
+				{
+					state.registers[ vm.sp_slot ] += blk->sp_offset;
+
+					// Look up the destination among the chained successors and fallback to the explored blocks.
+					//
+					compiled_block* next = nullptr;
+					for ( auto& [vip, dst] : blk->successors )
+					{
+						if ( vip == ctx.target )
+						{
+							next = dst;
+							break;
+						}
+					}
+					if ( !next )
+					{
+						const basic_block* dst = vm.rtn->explored_blocks.find( ctx.target );
+						if ( !dst )
+							return { exit_reason::unexplored_block, ctx.target, blk->block };
+						next = compile( dst );
+						blk->successors.push_back( { ctx.target, next } );
+					}
+					else if ( !next->is_current() )
+					{
+						next = compile( next->block );
+					}
+					blk = next;
+					break;
+				}
+				default:
+					// Block ended without a branch, which can only happen if it is incomplete.
+					//
+					return { exit_reason::unexplored_block, invalid_vip, blk->block };
+			}
+		}
+	}
+};
@@ -0,0 +1,200 @@
+// Copyright (c) 2020 Can Boluk and contributors of the VTIL Project   
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of mosquitto nor the names of its   
+//    contributors may be used to endorse or promote products derived from   
+//    this software without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "interpreter.hpp"
+
+namespace vtil
+{
+	// Memory accessed by the compiled code via LDD and STR.
+	//
+	struct jit_memory
+	{
+		// Flat buffer mapped at the base address, accesses outside of it fault. Used if not null.
+		//
+		uint8_t* buffer = nullptr;
+		uint64_t base = 0;
+		size_t size = 0;
+
+		// Callbacks used if there is no buffer, if neither is set the sparse memory of the state is used.
+		//
+		std::function<uint64_t( uint64_t address, size_t byte_count )> read;
+		std::function<void( uint64_t address, uint64_t value, size_t byte_count )> write;
+	};
+
+	// Executable memory the compiled code is placed in, chunks are only writable while code is being copied in.
+	//
+	struct jit_code_heap
+	{
+		static constexpr size_t chunk_size = 64 * 1024;
+
+		struct chunk
+		{
+			uint8_t* base;
+			size_t size;
+			size_t used;
+		};
+		std::vector<chunk> chunks;
+
+		jit_code_heap() = default;
+		jit_code_heap( const jit_code_heap& ) = delete;
+		jit_code_heap& operator=( const jit_code_heap& ) = delete;
+		~jit_code_heap() { reset(); }
+
+		// Copies the code into executable memory, returns nullptr if the memory could not be allocated.
+		//
+		void* allocate( const uint8_t* code, size_t length );
+
+		// Releases all of the memory.
+		//
+		void reset();
+	};
+
+	// Compiles the blocks of a routine into x86-64 code on their first execution.
+	// - Registers stay in the register file of the state, which the compiled code addresses 
+	//   directly; 64-bit data and arithmetic instructions on whole registers and immediates are 
+	//   emitted natively and every other instruction calls into the interpreter handler.
+	// - LDD and STR go through the memory set in the jit, see jit_memory.
+	// - Compiled blocks are cached by their entry VIP and recompiled when the stream or the stack 
+	//   pointer offset of the block changes, in-place modifications of instructions are not 
+	//   tracked and must be followed by a call to invalidate.
+	// - Branches are chained via the successors each compiled block has branched to before, so
+	//   the cache is only consulted for the first branch to each destination.
+	// - Instruction limit is checked before each block, the execution stops before the block that
+	//   would exceed it.
+	// - On targets other than x86-64 or if executable memory cannot be allocated, blocks execute
+	//   via the same handlers without native code.
+	// - Not thread-safe, each thread should use its own jit.
+	//
+	struct jit
+	{
+		// State passed to the compiled code, registers must stay as the first member.
+		//
+		struct context
+		{
+			uint64_t* registers;
+			jit* owner;
+			interpreter_state* state;
+			uint64_t target;
+			const interpreter::decoded_instruction* last;
+		};
+		using helper_type = interpreter::control( * )( context*, const interpreter::decoded_instruction* );
+		using entry_type = interpreter::control( * )( context* );
+
+		// Compiled block and the version of the block it was compiled from.
+		//
+		struct compiled_block
+		{
+			const basic_block* block = nullptr;
+			uint64_t edit_epoch = 0;
+			uint64_t shift_epoch = 0;
+			size_t length = 0;
+			int64_t sp_offset = 0;
+			bool is_valid = false;
+
+			std::unique_ptr<interpreter::decoded_block> decoded;
+			std::vector<helper_type> helpers;
+			entry_type entry = nullptr;
+			size_t native_count = 0;
+
+			std::vector<std::pair<vip_t, compiled_block*>> successors;
+
+			// Returns whether or not the code matches the block.
+			//
+			bool is_current() const
+			{
+				return is_valid &&
+					edit_epoch == block->stream.edit_epoch &&
+					shift_epoch == block->stream.shift_epoch &&
+					length == block->size() &&
+					sp_offset == block->sp_offset;
+			}
+		};
+
+		// Interpreter the slots and handlers are taken from.
+		//
+		interpreter vm;
+
+		// Memory accessed via LDD and STR.
+		//
+		jit_memory memory;
+
+		// Compiled blocks by entry VIP and the memory holding their code.
+		//
+		std::unordered_map<vip_t, std::unique_ptr<compiled_block>> cache;
+		jit_code_heap code_heap;
+		size_t compile_count = 0;
+
+		// Prepares the routine for compilation, blocks are compiled on demand.
+		//
+		jit( const routine* rtn ) : vm( rtn ) {}
+
+		// Returns whether or not native code can be generated for the target.
+		//
+		static bool is_supported();
+
+		// Creates a state with every register and the memory zeroed.
+		//
+		interpreter_state create_state() const { return vm.create_state(); }
+
+		// Reads and writes registers in the state.
+		//
+		uint64_t read_register( const interpreter_state& state, const register_desc& reg ) const { return vm.read_register( state, reg ); }
+		void write_register( interpreter_state& state, const register_desc& reg, uint64_t value ) const { vm.write_register( state, reg, value ); }
+
+		// Executes the routine starting from the block until it exits or the instruction limit is hit.
+		//
+		interpreter_exit run( interpreter_state& state, const basic_block* entry, uint64_t instruction_limit = ~0ull );
+		interpreter_exit run( interpreter_state& state, uint64_t instruction_limit = ~0ull ) { return run( state, vm.rtn->entry_point, instruction_limit ); }
+
+		// Returns the compiled block, compiling it if it is not in the cache or is out of date.
+		//
+		compiled_block* compile( const basic_block* blk );
+
+		// Marks the block at the VIP for recompilation.
+		//
+		void invalidate( vip_t vip );
+
+		// Drops every compiled block.
+		//
+		void flush();
+
+		// Accesses the memory on behalf of the compiled code, returns false if the access faults.
+		//
+		bool load( interpreter_state& state, uint64_t address, size_t byte_count, uint64_t& value );
+		bool store( interpreter_state& state, uint64_t address, uint64_t value, size_t byte_count );
+
+	private:
+		// Compiles the block into the entry.
+		//
+		void build( compiled_block* out, const basic_block* blk );
+	};
+};